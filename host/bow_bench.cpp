@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "bytes.h"
+#include "clock.h"
+#include "cmds.h"
+#include "parser.h"
+#include "transport.h"
+
+/**
+ * Measures how many frames per second the shared protocol code can encode and parse.
+ * Usage: bow_bench [rounds]
+ */
+
+// Bytes handed to the parser at once, about what the receive task gets from the UART driver.
+#define CHUNK_SIZE 16
+
+static std::vector<uint8_t> sent;
+
+void transportWrite(const uint8_t *data, size_t length) {
+    sent.insert(sent.end(), data, data + length);
+}
+
+/**
+ * A mix of what we see on the bus, including 0x10s that need escaping.
+ */
+static std::vector<messageType> sampleMessages() {
+    std::vector<messageType> messages;
+    messages.push_back(handoffMsg(MSG_MOTOR));
+    messages.push_back(handoffMsg(MSG_DISPLAY));
+    messages.push_back(pingReq(MSG_DISPLAY, MSG_BMS));
+    messages.push_back(pingResp(MSG_MOTOR, MSG_BMS));
+    messages.push_back(cmdReq(MSG_MOTOR, MSG_BMS, CMD_MOTOR_ON));
+
+    uint8_t putData[] = {0x94, 0xb0, FROM_UINT16(2500), 0x14, 0xb1, FROM_UINT16(276)};
+    messages.push_back(cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA, putData, sizeof(putData)));
+
+    uint8_t calibration[] = {0x00, 0x94, 0x38, 0x4b, 0x10, 0x28, 0x3a, 0x3e, 0x10, 0x79, 0x10};
+    messages.push_back(cmdResp(MSG_MOTOR, MSG_BMS, CMD_GET_DATA, calibration, sizeof(calibration)));
+
+    uint8_t display[] = {0x03, 0x02, 0x09, FROM_UINT16(253), FROM_UINT32(0x1010), FROM_UINT32(123456)};
+    messages.push_back(cmdReq(MSG_DISPLAY, MSG_BMS, 0x28, display, sizeof(display)));
+
+    uint8_t full[15];
+    memset(full, 0x10, sizeof(full));
+    messages.push_back(cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA, full, sizeof(full)));
+    return messages;
+}
+
+static bool sameMessage(const messageType& sent, const frameView& received) {
+    return sent.target == received.target && sent.type == received.type && sent.source == received.source && sent.command == received.command &&
+           sent.payloadSize == received.payloadSize && memcmp(sent.payload, received.payload, sent.payloadSize) == 0;
+}
+
+/**
+ * Parse the stream once, checking every frame comes out as it went in.
+ */
+static bool verify(const std::vector<messageType>& messages, const std::vector<uint8_t>& stream) {
+    bowParser parser;
+    parserInit(&parser);
+    size_t next = 0;
+    for(size_t pos = 0; pos < stream.size();) {
+        pos += parserWrite(&parser, stream.data() + pos, stream.size() - pos < CHUNK_SIZE ? stream.size() - pos : CHUNK_SIZE);
+        frameView frame;
+        readResult result;
+        while((result = parserNext(&parser, &frame)) != MSG_CONTINUE) {
+            if(result != MSG_OK || next >= messages.size() || !sameMessage(messages[next], frame)) {
+                fprintf(stderr, "Mismatch at frame %zu, result %d\n", next, result);
+                return false;
+            }
+            parserRelease(&parser);
+            next++;
+        }
+    }
+    if(next != messages.size()) {
+        fprintf(stderr, "Parsed %zu frames, expected %zu\n", next, messages.size());
+        return false;
+    }
+    return true;
+}
+
+static void report(const char *name, size_t frames, size_t bytes, int64_t us) {
+    const double seconds = us / 1e6;
+    printf("%-7s %10zu frames in %8.3f s: %12.0f frames/s, %8.1f ns/frame, %6.1f MB/s\n", name, frames, seconds, frames / seconds, us * 1000.0 / frames,
+           bytes / seconds / 1e6);
+}
+
+int main(int argc, char **argv) {
+    const size_t rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+
+    // Repeat the samples, so a round is about a second of bus traffic.
+    const std::vector<messageType> samples = sampleMessages();
+    std::vector<messageType> messages;
+    for(size_t repeat = 0; repeat < 8; repeat++) {
+        messages.insert(messages.end(), samples.begin(), samples.end());
+    }
+
+    // Encode, through writeMessage(..) like the firmware does.
+    int64_t start = clockNowUs();
+    size_t bytes = 0;
+    for(size_t round = 0; round < rounds; round++) {
+        sent.clear();
+        for(const messageType& message : messages) {
+            writeMessage(message);
+        }
+        bytes += sent.size();
+    }
+    report("encode", rounds * messages.size(), bytes, clockNowUs() - start);
+
+    const std::vector<uint8_t> stream = sent;
+    if(!verify(messages, stream)) {
+        return 1;
+    }
+
+    // Parse, in chunks like the receive task does.
+    bowParser parser;
+    parserInit(&parser);
+    size_t frames = 0;
+    start = clockNowUs();
+    for(size_t round = 0; round < rounds; round++) {
+        for(size_t pos = 0; pos < stream.size();) {
+            pos += parserWrite(&parser, stream.data() + pos, stream.size() - pos < CHUNK_SIZE ? stream.size() - pos : CHUNK_SIZE);
+            frameView frame;
+            while(parserNext(&parser, &frame) == MSG_OK) {
+                parserRelease(&parser);
+                frames++;
+            }
+        }
+    }
+    report("parse", frames, rounds * stream.size(), clockNowUs() - start);
+
+    return frames == rounds * messages.size() ? 0 : 1;
+}
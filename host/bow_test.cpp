@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "bytes.h"
+#include "cmds.h"
+#include "crc8.h"
+#include "data.h"
+#include "parser.h"
+#include "transport.h"
+
+/**
+ * Checks of the shared protocol code, one test per run, see the add_test(..) lines in CMakeLists.txt.
+ * Usage: bow_test <test>
+ */
+
+static std::vector<uint8_t> sent;
+
+void transportWrite(const uint8_t *data, size_t length) {
+    sent.insert(sent.end(), data, data + length);
+}
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                  \
+    do {                                                                                  \
+        if(!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                                   \
+        }                                                                                 \
+    } while(0)
+
+/**
+ * One of each message type, with payloads of every length, and 0x10s where they need escaping.
+ */
+static std::vector<messageType> sampleMessages() {
+    std::vector<messageType> messages;
+    messages.push_back(handoffMsg(MSG_MOTOR));
+    messages.push_back(handoffMsg(MSG_DISPLAY));
+    messages.push_back(pingReq(MSG_DISPLAY, MSG_BMS));
+    messages.push_back(pingResp(MSG_MOTOR, MSG_BMS));
+    messages.push_back(cmdReq(MSG_MOTOR, MSG_BMS, CMD_MOTOR_ON));
+    messages.push_back(cmdResp(MSG_BMS, MSG_MOTOR, CMD_MOTOR_ON));
+    // A 0x10 as command.
+    messages.push_back(cmdReq(MSG_MOTOR, MSG_BMS, 0x10));
+
+    uint8_t payload[15];
+    for(size_t size = 1; size <= sizeof(payload); size++) {
+        for(size_t pos = 0; pos < size; pos++) {
+            payload[pos] = (uint8_t)(pos * 7 + size);
+        }
+        messages.push_back(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_PUT_DATA, payload, size));
+        memset(payload, 0x10, size);
+        messages.push_back(cmdResp(MSG_BMS, MSG_MOTOR, CMD_GET_DATA, payload, size));
+    }
+    return messages;
+}
+
+static bool sameMessage(const messageType& message, const frameView& frame) {
+    return message.target == frame.target && message.type == frame.type && message.source == frame.source && message.command == frame.command &&
+           message.payloadSize == frame.payloadSize && memcmp(message.payload, frame.payload, message.payloadSize) == 0;
+}
+
+/**
+ * Feed the stream to a parser chunk bytes at a time, returns how many frames came out matching messages, in order.
+ */
+static size_t parseStream(const std::vector<messageType>& messages, const std::vector<uint8_t>& stream, size_t chunk) {
+    bowParser parser;
+    parserInit(&parser);
+    size_t matched = 0;
+    for(size_t pos = 0; pos < stream.size();) {
+        pos += parserWrite(&parser, stream.data() + pos, stream.size() - pos < chunk ? stream.size() - pos : chunk);
+        frameView frame;
+        readResult result;
+        while((result = parserNext(&parser, &frame)) != MSG_CONTINUE) {
+            CHECK(result == MSG_OK);
+            if(result == MSG_OK) {
+                CHECK(matched < messages.size() && sameMessage(messages[matched], frame));
+                matched++;
+                parserRelease(&parser);
+            }
+        }
+    }
+    return matched;
+}
+
+/**
+ * Everything writeMessage(..) sends parses back into the same message, however the bytes are split up.
+ */
+static void testRoundTrip() {
+    const std::vector<messageType> messages = sampleMessages();
+    sent.clear();
+    for(const messageType& message : messages) {
+        writeMessage(message);
+    }
+
+    for(size_t chunk = 1; chunk <= FRAME_MAX_ENCODED_SIZE + 1; chunk++) {
+        CHECK(parseStream(messages, sent, chunk) == messages.size());
+    }
+}
+
+/**
+ * A view stays valid while back to back frames keep arriving, the parser waits for it to be released
+ * instead of reusing its slot, and loses nothing meanwhile.
+ */
+static void testHeldView() {
+    std::vector<messageType> messages;
+    for(size_t index = 0; index < 3 * PARSER_FRAME_SLOTS; index++) {
+        uint8_t payload[15];
+        memset(payload, (uint8_t)index, sizeof(payload));
+        messages.push_back(cmdReq(MSG_BMS, MSG_MOTOR, CMD_PUT_DATA, payload, sizeof(payload)));
+    }
+    sent.clear();
+    for(const messageType& message : messages) {
+        writeMessage(message);
+    }
+
+    bowParser parser;
+    parserInit(&parser);
+    size_t written = 0;
+    size_t parsed = 0;
+    frameView held = {};
+    // Feed everything we can without releasing anything, like a receive task faster than the application.
+    while(true) {
+        written += parserWrite(&parser, sent.data() + written, sent.size() - written);
+        frameView frame;
+        readResult result;
+        size_t before = parsed;
+        while((result = parserNext(&parser, &frame)) == MSG_OK) {
+            if(parsed == 0) {
+                held = frame;
+            }
+            parsed++;
+        }
+        CHECK(result == MSG_CONTINUE);
+        if(parsed == before) {
+            break;
+        }
+    }
+    CHECK(parsed == PARSER_FRAME_SLOTS);
+    CHECK(written < sent.size());
+    CHECK(sameMessage(messages[0], held));
+
+    // Hand them back in order, and the rest comes out as it went in.
+    for(size_t index = 0; index < parsed; index++) {
+        parserRelease(&parser);
+    }
+    while(written < sent.size() || parsed < messages.size()) {
+        written += parserWrite(&parser, sent.data() + written, sent.size() - written);
+        frameView frame;
+        const readResult result = parserNext(&parser, &frame);
+        if(result == MSG_CONTINUE && written == sent.size()) {
+            break;
+        }
+        if(result == MSG_OK) {
+            CHECK(parsed < messages.size() && sameMessage(messages[parsed], frame));
+            parsed++;
+            parserRelease(&parser);
+        }
+    }
+    CHECK(parsed == messages.size());
+}
+
+/**
+ * Every 0x10 after the start byte is doubled, and nothing else is. Compile time frames encode the same.
+ */
+static void testEscaping() {
+    for(const messageType& message : sampleMessages()) {
+        uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+        const size_t length = encodeMessage(message, encoded);
+
+        CHECK(encoded[0] == 0x10);
+        std::vector<uint8_t> body;
+        for(size_t pos = 1; pos < length; pos++) {
+            if(encoded[pos] == 0x10) {
+                CHECK(pos + 1 < length && encoded[pos + 1] == 0x10);
+                pos++;
+            }
+            body.push_back(encoded[pos]);
+        }
+
+        // Header, payload and crc.
+        CHECK(body.size() == frameBodyLength(message) + 1);
+        for(size_t index = 0; index < frameBodyLength(message) && index < body.size(); index++) {
+            CHECK(body[index] == frameBodyByte(message, index));
+        }
+
+        uint8_t compileTime[FRAME_MAX_ENCODED_SIZE];
+        CHECK(encodeFrame(message, compileTime, crc8_bow_byte_bitwise) == length && memcmp(compileTime, encoded, length) == 0);
+    }
+
+    const constFrame& handoff = handoffFrame(MSG_MOTOR);
+    uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+    CHECK(encodeMessage(handoffMsg(MSG_MOTOR), encoded) == handoff.length && memcmp(encoded, handoff.bytes, handoff.length) == 0);
+}
+
+/**
+ * The last byte of a frame is the crc of the unescaped bytes before it, including the start byte,
+ * and a frame with a wrong crc is reported as a CRC error.
+ */
+static void testCrc() {
+    for(const messageType& message : sampleMessages()) {
+        uint8_t frame[FRAME_MAX_SIZE];
+        frame[0] = 0x10;
+        const size_t bodyLength = frameBodyLength(message);
+        for(size_t index = 0; index < bodyLength; index++) {
+            frame[index + 1] = frameBodyByte(message, index);
+        }
+
+        uint8_t expected = INIT;
+        for(size_t pos = 0; pos <= bodyLength; pos++) {
+            expected = crc8_bow_byte_bitwise(expected, frame[pos]);
+        }
+        CHECK(crc8_bow(frame, bodyLength + 1) == expected);
+
+        uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+        const size_t length = encodeMessage(message, encoded);
+        CHECK(encoded[length - 1] == expected);
+
+        // Flip each bit of the crc, skipping values that would need escaping.
+        if(expected != 0x10) {
+            for(uint8_t bit = 0; bit < 8; bit++) {
+                const uint8_t flipped = expected ^ (1 << bit);
+                if(flipped == 0x10) {
+                    continue;
+                }
+                encoded[length - 1] = flipped;
+                bowParser parser;
+                parserInit(&parser);
+                parserWrite(&parser, encoded, length);
+                frameView view;
+                CHECK(parserNext(&parser, &view) == MSG_CRC_ERROR);
+            }
+        }
+    }
+}
+
+/**
+ * Every implementation processes a byte at a time, with the crc so far as only state.
+ * So if they agree for every starting crc and every byte value, they agree for all inputs.
+ */
+static void testCrcExhaustive() {
+    for(uint32_t crc = 0; crc < 256; crc++) {
+        for(uint32_t value = 0; value < 256; value++) {
+            const uint8_t data = value;
+            const uint8_t bitwise = crc8_bow_update_bitwise(crc, &data, 1);
+            CHECK(crc8_bow_update_table256(crc, &data, 1) == bitwise);
+            CHECK(crc8_bow_update_table16(crc, &data, 1) == bitwise);
+            CHECK(crc8_bow_byte_bitwise(crc, data) == bitwise);
+            CHECK(crc8_bow_byte(crc, data) == bitwise);
+        }
+    }
+}
+
+/**
+ * Late answers to requests that were given up on, and answers from other nodes, arrive before the real one.
+ * Only the real one answers the request, with its payload.
+ */
+static void testStaleReply() {
+    uint8_t serial[] = {0x12, 0x34, 0x56, 0x78};
+    uint8_t other[] = {0xde, 0xad, 0xbe, 0xef};
+    const messageType request = cmdReq(MSG_DISPLAY, MSG_BMS, CMD_GET_SERIAL);
+    const messageType stale[] = {
+        // The motor, late with 'motor on' and with its serial.
+        cmdResp(MSG_BMS, MSG_MOTOR, CMD_MOTOR_ON),
+        cmdResp(MSG_BMS, MSG_MOTOR, CMD_GET_SERIAL, other, sizeof(other)),
+        // The display, late with a ping and with an earlier command.
+        pingResp(MSG_BMS, MSG_DISPLAY),
+        cmdResp(MSG_BMS, MSG_DISPLAY, CMD_BUTTON_POLL, other, sizeof(other)),
+        // Not for us.
+        cmdResp(MSG_MOTOR, MSG_DISPLAY, CMD_GET_SERIAL, other, sizeof(other)),
+        // A request, not a response.
+        cmdReq(MSG_BMS, MSG_DISPLAY, CMD_GET_SERIAL),
+    };
+    const messageType answer = cmdResp(MSG_BMS, MSG_DISPLAY, CMD_GET_SERIAL, serial, sizeof(serial));
+
+    sent.clear();
+    for(const messageType& message : stale) {
+        writeMessage(message);
+    }
+    writeMessage(answer);
+
+    bowParser parser;
+    parserInit(&parser);
+    parserWrite(&parser, sent.data(), sent.size());
+    size_t answered = 0;
+    size_t frames = 0;
+    frameView frame;
+    while(parserNext(&parser, &frame) == MSG_OK) {
+        if(isResponseTo(request, frame)) {
+            CHECK(frames == sizeof(stale) / sizeof(stale[0]) && sameMessage(answer, frame));
+            answered++;
+        }
+        frames++;
+        parserRelease(&parser);
+    }
+    CHECK(frames == sizeof(stale) / sizeof(stale[0]) + 1);
+    CHECK(answered == 1);
+
+    // Pings are answered by a ping response from the node, whatever the command byte.
+    CHECK(isResponseTo(pingReq(MSG_MOTOR, MSG_BMS), frameView{MSG_BMS, MSG_MOTOR, MSG_PING_RESP, 0x00, NULL, 0}));
+    CHECK(!isResponseTo(pingReq(MSG_MOTOR, MSG_BMS), frameView{MSG_BMS, MSG_DISPLAY, MSG_PING_RESP, 0x00, NULL, 0}));
+    CHECK(!isResponseTo(pingReq(MSG_MOTOR, MSG_BMS), frameView{MSG_BMS, MSG_MOTOR, MSG_CMD_RESP, 0x00, NULL, 0}));
+}
+
+/**
+ * The motor's speed and distance PUT DATA, laid out as the original handler read it: c0 at offset 1 with
+ * 2 value bytes, c1 at offset 5 with 4. Decodes with the registry sizes whatever the type bits are.
+ */
+static void testPutDataLayout() {
+    const uint8_t types[] = {DATA_TYPE_UINT, DATA_TYPE_INT};
+    for(const uint8_t type : types) {
+        const uint8_t payload[] = {(uint8_t)(DATA_MORE | type | DATA_SIZE_2), DATA_SPEED, FROM_UINT16(2500), (uint8_t)(type | DATA_SIZE_4), DATA_DISTANCE, FROM_UINT32(123456)};
+        dataReader reader;
+        dataReaderInit(&reader, payload, sizeof(payload));
+
+        dataItem item;
+        CHECK(dataReadValue(&reader, &item) && item.id == DATA_SPEED && dataUint(item) == 2500);
+        CHECK((item.tag & DATA_SIZE_MASK) == (dataLookup(DATA_SPEED)->tag & DATA_SIZE_MASK));
+        CHECK(dataReadValue(&reader, &item) && item.id == DATA_DISTANCE && dataUint(item) == 123456);
+        CHECK((item.tag & DATA_SIZE_MASK) == (dataLookup(DATA_DISTANCE)->tag & DATA_SIZE_MASK));
+        CHECK(!dataReadValue(&reader, &item) && reader.pos == sizeof(payload));
+    }
+}
+
+struct testCase {
+    const char *name;
+    void (*run)();
+};
+
+static const testCase tests[] = {
+    {"roundtrip", testRoundTrip},
+    {"held_view", testHeldView},
+    {"escaping", testEscaping},
+    {"crc", testCrc},
+    {"crc_exhaustive", testCrcExhaustive},
+    {"stale_reply", testStaleReply},
+    {"put_data_layout", testPutDataLayout},
+};
+
+int main(int argc, char **argv) {
+    size_t ran = 0;
+    for(const testCase& test : tests) {
+        if(argc > 1 && strcmp(argv[1], test.name) != 0) {
+            continue;
+        }
+        ran++;
+        const int before = failures;
+        test.run();
+        printf("%-12s %s\n", test.name, failures == before ? "ok" : "FAILED");
+    }
+    if(ran == 0) {
+        fprintf(stderr, "No test named %s\n", argv[1]);
+        return 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include "clock.h"
+#include "deferred_log.h"
+#include "sim.h"
+
+/**
+ * Runs the simulated motor and display against a real BMS (the firmware) on a serial port,
+ * or on a new pseudo-terminal which is printed at start.
+ *
+ * Usage: bus_sim [--device PATH] [--display cu2|cu3|none] [--wakeup-after MS] [--timeout MS] [--no-assist] [--verbose]
+ *
+ * Sends the wakeup byte after --wakeup-after, and reports how long each step up to assist took.
+ * Stops a second after assist is on, or at --timeout.
+ */
+
+static void usage() {
+    fprintf(stderr, "Usage: bus_sim [--device PATH] [--display cu2|cu3|none] [--wakeup-after MS] [--timeout MS] [--no-assist] [--verbose]\n");
+    exit(2);
+}
+
+static bool setRaw(int fd, bool setSpeed) {
+    struct termios tio;
+    if(tcgetattr(fd, &tio) != 0) {
+        return false;
+    }
+    cfmakeraw(&tio);
+    if(setSpeed) {
+        cfsetispeed(&tio, B9600);
+        cfsetospeed(&tio, B9600);
+    }
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+/**
+ * Create a pty, the firmware side opens the printed path.
+ * The slave side is kept open too, so the master doesn't see a hangup while nobody is connected.
+ */
+static int openPty(int *slave) {
+    const int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pty");
+        return -1;
+    }
+    const char *name = ptsname(master);
+    *slave = open(name, O_RDWR | O_NOCTTY);
+    if(*slave < 0 || !setRaw(*slave, false)) {
+        perror(name);
+        return -1;
+    }
+    printf("Bus on %s\n", name);
+    return master;
+}
+
+static int openDevice(const char *path) {
+    const int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0 || !setRaw(fd, true)) {
+        perror(path);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    const char *device = NULL;
+    simConfig config = {};
+    config.display = SIM_CU3;
+    config.motorDelayUs = 4000;
+    config.displayDelayUs = 3000;
+    config.requestAssist = true;
+    int64_t wakeupAfterUs = 1000 * 1000;
+    int64_t timeoutUs = 30 * 1000 * 1000;
+
+    for(int arg = 1; arg < argc; arg++) {
+        if(strcmp(argv[arg], "--device") == 0 && arg + 1 < argc) {
+            device = argv[++arg];
+        } else if(strcmp(argv[arg], "--display") == 0 && arg + 1 < argc) {
+            const char *display = argv[++arg];
+            if(strcmp(display, "cu2") == 0) {
+                config.display = SIM_CU2;
+            } else if(strcmp(display, "cu3") == 0) {
+                config.display = SIM_CU3;
+            } else if(strcmp(display, "none") == 0) {
+                config.display = SIM_NO_DISPLAY;
+            } else {
+                usage();
+            }
+        } else if(strcmp(argv[arg], "--wakeup-after") == 0 && arg + 1 < argc) {
+            wakeupAfterUs = atoll(argv[++arg]) * 1000;
+        } else if(strcmp(argv[arg], "--timeout") == 0 && arg + 1 < argc) {
+            timeoutUs = atoll(argv[++arg]) * 1000;
+        } else if(strcmp(argv[arg], "--no-assist") == 0) {
+            config.requestAssist = false;
+        } else if(strcmp(argv[arg], "--verbose") == 0) {
+            config.verbose = true;
+        } else {
+            usage();
+        }
+    }
+
+    int slave = -1;
+    const int fd = device != NULL ? openDevice(device) : openPty(&slave);
+    if(fd < 0) {
+        return 1;
+    }
+
+    static simBus bus;
+    simInit(&bus, config);
+
+    const int64_t start = clockNowUs();
+    bool wokeUp = false;
+    int64_t assistAt = -1;
+    while(true) {
+        int64_t now = clockNowUs();
+        if(now - start > timeoutUs || (assistAt >= 0 && now - assistAt > 1000 * 1000)) {
+            break;
+        }
+        if(!wokeUp && now - start >= wakeupAfterUs) {
+            simWakeup(&bus, now);
+            wokeUp = true;
+        }
+
+        // Sleep until the BMS sends something, or we have a byte due, but at most 10ms.
+        int64_t waitUs = 10 * 1000;
+        const int64_t next = simNextByteTime(&bus);
+        if(next >= 0 && next - now < waitUs) {
+            waitUs = next > now ? next - now : 0;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if(poll(&pfd, 1, (int)((waitUs + 999) / 1000)) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+
+        now = clockNowUs();
+        if((pfd.revents & POLLIN) != 0) {
+            uint8_t data[256];
+            const ssize_t length = read(fd, data, sizeof(data));
+            if(length > 0) {
+                simFromBms(&bus, data, length, now);
+            }
+        }
+
+        uint8_t out[64];
+        const size_t length = simToBms(&bus, out, sizeof(out), now);
+        if(length > 0 && write(fd, out, length) != (ssize_t)length) {
+            perror("write");
+            return 1;
+        }
+
+        logDrain();
+
+        if(assistAt < 0 && simAssistOn(&bus)) {
+            assistAt = now;
+        }
+    }
+
+    simReport(&bus);
+    if(slave >= 0) {
+        close(slave);
+    }
+    close(fd);
+    return assistAt >= 0 || !config.requestAssist ? 0 : 1;
+}
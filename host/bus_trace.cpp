@@ -0,0 +1,415 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include "cmds.h"
+#include "message.h"
+#include "parser.h"
+#include "trace_format.h"
+
+/**
+ * Decodes a bus trace as written by the firmware (see trace_format.h), for example read with
+ *   parttool.py read_partition --partition-name trace --output trace.bin
+ * and reports bus utilisation, gaps between frames, handoff cycle and turn times, response times per node,
+ * and CRC error and incomplete frame rates. The trace is read in blocks, so its length does not matter.
+ *
+ * Usage: bus_trace [--rx-only] [--frames] FILE
+ *
+ * --rx-only ignores what the firmware sent, for a bus where the UART also receives its own bytes.
+ * --frames prints every frame, with the names from cmds.h.
+ *
+ * Times on the bus are estimated from the record times: received bytes were read at the record time,
+ * so they ended one byte time apart before it. Sent bytes start going out at the record time.
+ */
+
+// 8N1 at 9600 baud.
+#define BYTE_US (10 * 1000000 / 9600)
+
+// Exact below 64us, above that 32 buckets per power of two.
+#define HIST_BUCKETS (64 + 40 * 32)
+
+struct histogram {
+    uint64_t count;
+    int64_t total;
+    int64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+static int bucketOf(int64_t us) {
+    if(us < 64) {
+        return us < 0 ? 0 : (int)us;
+    }
+    const int exponent = 63 - __builtin_clzll((uint64_t)us);
+    const int bucket = 64 + (exponent - 6) * 32 + (int)((us >> (exponent - 5)) & 31);
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+static int64_t bucketMiddle(int bucket) {
+    if(bucket < 64) {
+        return bucket;
+    }
+    const int exponent = (bucket - 64) / 32 + 6;
+    const int64_t width = (int64_t)1 << (exponent - 5);
+    return (32 + (bucket - 64) % 32) * width + width / 2;
+}
+
+static void histAdd(histogram *hist, int64_t us) {
+    hist->count++;
+    hist->total += us;
+    if(us > hist->max) {
+        hist->max = us;
+    }
+    hist->buckets[bucketOf(us)]++;
+}
+
+static int64_t histPercentile(const histogram& hist, double percentile) {
+    const uint64_t rank = (uint64_t)(hist.count * percentile / 100.0);
+    uint64_t seen = 0;
+    for(int bucket = 0; bucket < HIST_BUCKETS; bucket++) {
+        seen += hist.buckets[bucket];
+        if(seen > rank) {
+            const int64_t middle = bucketMiddle(bucket);
+            return middle < hist.max ? middle : hist.max;
+        }
+    }
+    return hist.max;
+}
+
+static void histPrint(const char *label, const histogram& hist) {
+    if(hist.count == 0) {
+        printf("  %-36s -\n", label);
+        return;
+    }
+    printf("  %-36s %8" PRIu64 " %9.1f %9.1f %9.1f %9.1f %9.1f\n", label, hist.count, hist.total / 1000.0 / hist.count,
+           histPercentile(hist, 50) / 1000.0, histPercentile(hist, 90) / 1000.0, histPercentile(hist, 99) / 1000.0, hist.max / 1000.0);
+}
+
+static void histHeader(const char *title) {
+    printf("%-38s %8s %9s %9s %9s %9s %9s\n", title, "count", "mean ms", "p50", "p90", "p99", "max");
+}
+
+// A request waiting for its response.
+struct pendingRequest {
+    bool active;
+    uint8_t target;
+    uint8_t source;
+    uint8_t type;
+    uint8_t command;
+    // When the request ended on the bus.
+    int64_t end;
+};
+
+struct traceAnalysis {
+    bool rxOnly;
+    bool printFrames;
+
+    // One parser per direction, their bytes were not interleaved on the bus.
+    bowParser parsers[2];
+
+    // Bus time covered, from the first record to the end of the last byte.
+    int64_t first;
+    int64_t last;
+    uint64_t bytes[2];
+
+    // Busiest second.
+    int64_t window;
+    uint64_t windowBytes;
+    uint64_t peakWindowBytes;
+
+    uint64_t frames;
+    uint64_t wakeups;
+    uint64_t crcErrors;
+
+    int64_t lastFrameEnd;
+    histogram gaps;
+
+    // Handoffs the BMS gave, and the turns of the nodes it gave them to.
+    int64_t lastHandoff;
+    histogram handoffCycle;
+    int turnHolder;
+    int64_t turnStart;
+    histogram turns[16];
+
+    pendingRequest pending;
+    uint64_t unanswered;
+    // By responding node, response type and command.
+    std::map<uint32_t, histogram> responses;
+};
+
+static const char *nodeLabel(uint8_t address, char *buffer, size_t size) {
+    const char *name = nodeName(address);
+    if(name != NULL) {
+        return name;
+    }
+    snprintf(buffer, size, "NODE_%X", address);
+    return buffer;
+}
+
+static void printFrame(const frameView& frame, uint8_t direction, int64_t start) {
+    static const char *typeNames[] = {"HANDOFF", "CMD_REQ", "CMD_RESP", "PING_RESP", "PING_REQ"};
+    char targetBuffer[8];
+    char sourceBuffer[8];
+    printf("%12.3f %s %-9s", start / 1000.0, direction == TRACE_TX ? ">>" : "<<", frame.type < 5 ? typeNames[frame.type] : "?");
+    if(frame.type == MSG_HANDOFF) {
+        printf(" to %s\n", nodeLabel(frame.target, targetBuffer, sizeof(targetBuffer)));
+        return;
+    }
+    printf(" %s > %s", nodeLabel(frame.source, sourceBuffer, sizeof(sourceBuffer)), nodeLabel(frame.target, targetBuffer, sizeof(targetBuffer)));
+    if(frame.type == MSG_CMD_REQ || frame.type == MSG_CMD_RESP) {
+        const char *name = cmdName(frame.command);
+        printf(" %02x %s", frame.command, name != NULL ? name : "");
+    }
+    for(size_t pos = 0; pos < frame.payloadSize; pos++) {
+        printf(" %02x", frame.payload[pos]);
+    }
+    printf("\n");
+}
+
+// Nothing is sent, the shared message code is only used for frame lengths.
+void transportWrite(const uint8_t *, size_t) {
+}
+
+static size_t encodedSize(const frameView& frame) {
+    messageType message = {};
+    message.target = frame.target;
+    message.source = frame.source;
+    message.type = frame.type;
+    message.command = frame.command;
+    memcpy(message.payload, frame.payload, frame.payloadSize);
+    message.payloadSize = frame.payloadSize;
+    uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+    return encodeMessage(message, encoded);
+}
+
+static void handleResponse(traceAnalysis *trace, const frameView& frame, int64_t start) {
+    pendingRequest& pending = trace->pending;
+    if(!pending.active || frame.source != pending.target || frame.target != pending.source) {
+        return;
+    }
+    const bool matches = (pending.type == MSG_PING_REQ && frame.type == MSG_PING_RESP) ||
+                         (pending.type == MSG_CMD_REQ && frame.type == MSG_CMD_RESP && frame.command == pending.command);
+    if(!matches) {
+        return;
+    }
+    const uint32_t key = (uint32_t)frame.source << 16 | (uint32_t)frame.type << 8 | (frame.type == MSG_CMD_RESP ? frame.command : 0);
+    histAdd(&trace->responses[key], start - pending.end);
+    pending.active = false;
+}
+
+static void handleFrame(traceAnalysis *trace, const frameView& frame, uint8_t direction, int64_t end) {
+    const int64_t start = end - (int64_t)encodedSize(frame) * BYTE_US;
+    trace->frames++;
+    if(trace->printFrames) {
+        printFrame(frame, direction, start);
+    }
+
+    if(trace->lastFrameEnd >= 0) {
+        histAdd(&trace->gaps, start - trace->lastFrameEnd);
+    }
+    trace->lastFrameEnd = end;
+
+    if(frame.type == MSG_HANDOFF) {
+        if(frame.target == MSG_BMS) {
+            if(trace->turnHolder >= 0) {
+                histAdd(&trace->turns[trace->turnHolder], start - trace->turnStart);
+            }
+            trace->turnHolder = -1;
+        } else {
+            // The BMS gives the bus away. A handoff without one back means the last node's turn timed out.
+            if(trace->lastHandoff >= 0) {
+                histAdd(&trace->handoffCycle, start - trace->lastHandoff);
+            }
+            trace->lastHandoff = start;
+            trace->turnHolder = frame.target;
+            trace->turnStart = end;
+        }
+    } else if(frame.type == MSG_CMD_REQ || frame.type == MSG_PING_REQ) {
+        if(trace->pending.active) {
+            trace->unanswered++;
+        }
+        trace->pending = {true, frame.target, frame.source, frame.type, frame.command, end};
+    } else {
+        handleResponse(trace, frame, start);
+    }
+}
+
+static void handleByte(traceAnalysis *trace, uint8_t direction, uint8_t byte, int64_t end) {
+    bowParser *parser = &trace->parsers[direction];
+    parserWrite(parser, &byte, 1);
+    frameView frame;
+    readResult result;
+    while((result = parserNext(parser, &frame)) != MSG_CONTINUE) {
+        if(result == MSG_OK) {
+            handleFrame(trace, frame, direction, end);
+            parserRelease(parser);
+        } else if(result == MSG_WAKEUP) {
+            trace->wakeups++;
+            trace->lastFrameEnd = end;
+            if(trace->printFrames) {
+                printf("%12.3f %s WAKEUP\n", (end - BYTE_US) / 1000.0, direction == TRACE_TX ? ">>" : "<<");
+            }
+        } else if(result == MSG_CRC_ERROR) {
+            trace->crcErrors++;
+            if(trace->printFrames) {
+                printf("%12.3f %s CRC ERROR\n", end / 1000.0, direction == TRACE_TX ? ">>" : "<<");
+            }
+        }
+    }
+}
+
+static void countWindow(traceAnalysis *trace, int64_t time, uint64_t bytes) {
+    const int64_t window = time / 1000000;
+    if(window != trace->window) {
+        trace->window = window;
+        trace->windowBytes = 0;
+    }
+    trace->windowBytes += bytes;
+    if(trace->windowBytes > trace->peakWindowBytes) {
+        trace->peakWindowBytes = trace->windowBytes;
+    }
+}
+
+static void handleRecord(traceAnalysis *trace, uint8_t direction, const uint8_t *data, uint8_t length, int64_t time) {
+    if(trace->first < 0) {
+        trace->first = time;
+    }
+    if(direction == TRACE_TX && trace->rxOnly) {
+        return;
+    }
+    trace->bytes[direction] += length;
+    countWindow(trace, time, length);
+
+    for(int pos = 0; pos < length; pos++) {
+        const int64_t end = direction == TRACE_TX ? time + (pos + 1) * BYTE_US : time - (length - 1 - pos) * BYTE_US;
+        if(end > trace->last) {
+            trace->last = end;
+        }
+        handleByte(trace, direction, data[pos], end);
+    }
+}
+
+static void report(const traceAnalysis& trace, const traceHeader& header) {
+    static const char *reasons[] = {"?", "panic", "keepalive"};
+    const int64_t duration = trace.last > trace.first ? trace.last - trace.first : 0;
+    const uint64_t bytes = trace.bytes[TRACE_RX] + trace.bytes[TRACE_TX];
+    const uint32_t incomplete = trace.parsers[TRACE_RX].incomplete + trace.parsers[TRACE_TX].incomplete;
+
+    printf("Trace: %.1fs, written %s, %" PRIu32 " bytes not recorded\n", duration / 1e6,
+           header.reason < 3 ? reasons[header.reason] : "?", header.dropped);
+    printf("Bytes: %" PRIu64 " received, %" PRIu64 " sent\n", trace.bytes[TRACE_RX], trace.bytes[TRACE_TX]);
+    printf("Utilisation at 9600 baud: %.1f%% overall, %.1f%% in the busiest second\n",
+           duration > 0 ? 100.0 * bytes * BYTE_US / duration : 0.0, 100.0 * trace.peakWindowBytes * BYTE_US / 1e6);
+
+    const double perThousand = trace.frames > 0 ? 1000.0 / trace.frames : 0.0;
+    printf("Frames: %" PRIu64 ", wakeups %" PRIu64 ", CRC errors %" PRIu64 " (%.2f per 1000 frames), incomplete %" PRIu32 " (%.2f per 1000 frames)\n",
+           trace.frames, trace.wakeups, trace.crcErrors, trace.crcErrors * perThousand, incomplete, incomplete * perThousand);
+    printf("Requests without a response: %" PRIu64 "\n\n", trace.unanswered);
+
+    histHeader("Timing");
+    histPrint("gap between frames", trace.gaps);
+    histPrint("handoff cycle", trace.handoffCycle);
+    char label[64];
+    char buffer[8];
+    for(int node = 0; node < 16; node++) {
+        if(trace.turns[node].count > 0) {
+            snprintf(label, sizeof(label), "turn %s", nodeLabel(node, buffer, sizeof(buffer)));
+            histPrint(label, trace.turns[node]);
+        }
+    }
+
+    printf("\n");
+    histHeader("Response time");
+    for(const auto& [key, hist] : trace.responses) {
+        const uint8_t node = key >> 16;
+        const uint8_t type = (key >> 8) & 0xff;
+        const uint8_t command = key & 0xff;
+        if(type == MSG_PING_RESP) {
+            snprintf(label, sizeof(label), "%s ping", nodeLabel(node, buffer, sizeof(buffer)));
+        } else {
+            const char *name = cmdName(command);
+            snprintf(label, sizeof(label), "%s %02x %s", nodeLabel(node, buffer, sizeof(buffer)), command, name != NULL ? name : "");
+        }
+        histPrint(label, hist);
+    }
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: bus_trace [--rx-only] [--frames] FILE\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    static traceAnalysis trace;
+    for(int arg = 1; arg < argc; arg++) {
+        if(strcmp(argv[arg], "--rx-only") == 0) {
+            trace.rxOnly = true;
+        } else if(strcmp(argv[arg], "--frames") == 0) {
+            trace.printFrames = true;
+        } else if(path == NULL && argv[arg][0] != '-') {
+            path = argv[arg];
+        } else {
+            usage();
+        }
+    }
+    if(path == NULL) {
+        usage();
+    }
+
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    traceHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a bus trace\n", path);
+        return 1;
+    }
+
+    parserInit(&trace.parsers[TRACE_RX]);
+    parserInit(&trace.parsers[TRACE_TX]);
+    trace.first = -1;
+    trace.window = -1;
+    trace.lastFrameEnd = -1;
+    trace.lastHandoff = -1;
+    trace.turnHolder = -1;
+
+    // Records never span more than one refill, they are at most TRACE_RECORD_HEADER_MAX + 0xff bytes.
+    static uint8_t buffer[64 * 1024];
+    size_t have = 0;
+    size_t pos = 0;
+    uint32_t remaining = header.size;
+    int64_t time = header.start;
+    while(remaining > 0) {
+        uint64_t delta;
+        uint8_t direction;
+        uint8_t length;
+        const size_t available = have - pos < remaining ? have - pos : remaining;
+        const size_t headerSize = traceDecodeHeader(buffer + pos, available, &delta, &direction, &length);
+        if(headerSize == 0 || headerSize + length > available) {
+            // Move what's left to the front, and read more.
+            memmove(buffer, buffer + pos, have - pos);
+            have -= pos;
+            pos = 0;
+            const size_t read = fread(buffer + have, 1, sizeof(buffer) - have, file);
+            if(read == 0) {
+                fprintf(stderr, "%s: trace ends %" PRIu32 " bytes early\n", path, remaining);
+                break;
+            }
+            have += read;
+            continue;
+        }
+
+        time += delta;
+        handleRecord(&trace, direction, buffer + pos + headerSize, length, time);
+        pos += headerSize + length;
+        remaining -= headerSize + length;
+    }
+    fclose(file);
+
+    report(trace, header);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <chrono>
+#include "clock.h"
+#include "clock_host.h"
+
+static bool virtualTime = false;
+static int64_t virtualNow = 0;
+
+int64_t clockNowUs() {
+    if(virtualTime) {
+        return virtualNow;
+    }
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void clockUseVirtual(int64_t startUs) {
+    virtualTime = true;
+    virtualNow = startUs;
+}
+
+void clockAdvanceUs(int64_t us) {
+    if(virtualTime && us > 0) {
+        virtualNow += us;
+    }
+}
+
+void clockAdvanceTo(int64_t timeUs) {
+    if(virtualTime && timeUs > virtualNow) {
+        virtualNow = timeUs;
+    }
+}
+
+bool clockIsVirtual() {
+    return virtualTime;
+}
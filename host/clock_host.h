@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * clockNowUs() for native builds: time since start, or virtual time.
+ * On virtual time the clock only moves when told to, so simulations run as fast as they can, and the same every run.
+ */
+
+/**
+ * Switch to virtual time, starting at the given time.
+ */
+void clockUseVirtual(int64_t startUs);
+
+/**
+ * Move virtual time forward, does nothing on real time.
+ */
+void clockAdvanceUs(int64_t us);
+
+/**
+ * Move virtual time to the given time, if that's later.
+ */
+void clockAdvanceTo(int64_t timeUs);
+
+bool clockIsVirtual();
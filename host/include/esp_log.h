@@ -0,0 +1,22 @@
+#pragma once
+
+// Just enough of the ESP-IDF logging macros for the shared protocol code, all to stderr.
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do {} while(0)
+
+#define ESP_LOG_BUFFER_HEX(tag, buffer, length) hostLogBufferHex(tag, buffer, length)
+
+static inline void hostLogBufferHex(const char *tag, const void *buffer, size_t length) {
+    fprintf(stderr, "I %s:", tag);
+    for(size_t pos = 0; pos < length; pos++) {
+        fprintf(stderr, " %02x", ((const uint8_t *)buffer)[pos]);
+    }
+    fprintf(stderr, "\n");
+}
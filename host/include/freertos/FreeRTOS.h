@@ -0,0 +1,7 @@
+#pragma once
+
+// Just enough of FreeRTOS for the declarations in bow.h, native builds don't run tasks.
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
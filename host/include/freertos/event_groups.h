@@ -0,0 +1,5 @@
+#pragma once
+
+// The state handlers include this on the firmware, native builds don't use event groups.
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,10 @@
+#pragma once
+
+// Kconfig values for native builds, the firmware gets these from the generated sdkconfig.h.
+
+#define CONFIG_ION_CRC8_TABLE_256 1
+#define CONFIG_ION_EXCHANGE_DEADLINE_MS 1000
+#define CONFIG_ION_TIMEOUT_MIN_MS 20
+#define CONFIG_ION_HANDOFF_TIMEOUT_MIN_MS 250
+#define CONFIG_ION_TIMEOUT_MAX_MS 500
+#define CONFIG_ION_TIMEOUT_INITIAL_MS 250
@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <string.h>
+#include "bytes.h"
+#include "cmds.h"
+#include "transport.h"
+#include "sim.h"
+
+// Least time between speed/distance updates from the motor.
+#define MOTOR_PUT_INTERVAL_US (500 * 1000)
+
+// Speed in km/h * 10 the rider does once assist is on.
+#define RIDE_SPEED 180
+
+static const char *milestoneNames[SIM_MILESTONES] = {
+    "wakeup", "first frame", "display init", "motor on", "motor update", "first handoff", "pairing check", "assist request", "assist on",
+};
+
+// The GET DATA queries a CU3 sends, one per turn, see the CU3 entries in handleMessage().
+static const uint8_t cu3Queries[][4] = {
+    {0x08, 0x3b}, {0x08, 0x80}, {0x08, 0x8e}, {0x14, 0x18}, {0x94, 0x18, 0x14, 0x1a}, {0x28, 0x94}, {0x44, 0x9a, 0x00}, {0x48, 0x99, 0x00},
+};
+static const size_t cu3QuerySizes[] = {2, 2, 2, 2, 4, 2, 3, 3};
+
+// Bus for transportWrite(..), the last one initialized.
+static simBus *inProcessBus;
+
+static void milestone(simBus *bus, simMilestone which) {
+    if(bus->milestones[which] < 0) {
+        bus->milestones[which] = bus->now;
+    }
+}
+
+static void logFrame(const simBus *bus, const char *direction, const uint8_t *data, size_t length) {
+    if(!bus->config.verbose) {
+        return;
+    }
+    printf("%10.3f %s", bus->now / 1000.0, direction);
+    for(size_t pos = 0; pos < length; pos++) {
+        printf(" %02x", data[pos]);
+    }
+    printf("\n");
+}
+
+/**
+ * Queue a message from one of our nodes, after the given reply delay, and after anything already queued.
+ */
+static void send(simBus *bus, const messageType& message, int64_t delayUs) {
+    uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+    const size_t length = encodeMessage(message, encoded);
+
+    int64_t time = bus->now + delayUs;
+    if(time < bus->busFreeAt) {
+        time = bus->busFreeAt;
+    }
+    for(size_t pos = 0; pos < length; pos++) {
+        time += SIM_BYTE_US;
+        bus->out.push_back({time, encoded[pos]});
+    }
+    bus->busFreeAt = time;
+    bus->framesOut++;
+    logFrame(bus, "<<", encoded, length);
+}
+
+static int64_t nodeDelay(const simBus *bus, const simNode& node) {
+    return node.address == MSG_MOTOR ? bus->config.motorDelayUs : bus->config.displayDelayUs;
+}
+
+/**
+ * Send the next request of this turn, or hand control back to the BMS when there are none left.
+ */
+static void continueTurn(simBus *bus, simNode& node) {
+    if(node.turn.empty()) {
+        node.awaiting = false;
+        send(bus, handoffMsg(MSG_BMS), nodeDelay(bus, node));
+        return;
+    }
+    send(bus, node.turn.front(), nodeDelay(bus, node));
+    node.turn.pop_front();
+    node.awaiting = true;
+}
+
+static void reply(simBus *bus, const simNode& node, const frameView& request, const uint8_t *payload, size_t payloadSize) {
+    send(bus, cmdResp(request.source, node.address, request.command, (uint8_t *)payload, payloadSize), nodeDelay(bus, node));
+}
+
+static void updateRide(simBus *bus) {
+    simMotor& motor = bus->motor;
+    motor.speed = motor.assist ? RIDE_SPEED : 0;
+    // km/h * 10 to 10m per microsecond.
+    motor.distance += motor.speed * (bus->now - motor.lastMove) / 360e6;
+    motor.lastMove = bus->now;
+}
+
+static void motorTurn(simBus *bus) {
+    simMotor& motor = bus->motor;
+    if(motor.quiet) {
+        // Like the XHP after motor off, it stops responding to handoffs.
+        return;
+    }
+
+    milestone(bus, SIM_FIRST_HANDOFF);
+    updateRide(bus);
+
+    if(motor.offPending) {
+        motor.offPending = false;
+        motor.quiet = true;
+        motor.node.turn.push_back(cmdReq(MSG_BMS, MSG_MOTOR, CMD_BAT_STATUS_MOTOR_OFF));
+    }
+    if(motor.assistPending) {
+        motor.assistPending = false;
+        uint8_t payload[] = {(uint8_t)(motor.assist ? 1 : 0)};
+        motor.node.turn.push_back(cmdReq(MSG_BMS, MSG_MOTOR, CMD_BAT_STATUS_ASSIST, payload, sizeof(payload)));
+    }
+    if(motor.on && bus->now - motor.lastPut >= MOTOR_PUT_INTERVAL_US) {
+        motor.lastPut = bus->now;
+        const uint32_t distance = (uint32_t)motor.distance;
+        uint8_t payload[] = {0x94, 0xc0, FROM_UINT16(motor.speed), 0x08, 0xc1, FROM_UINT32(distance)};
+        motor.node.turn.push_back(cmdReq(MSG_BMS, MSG_MOTOR, CMD_PUT_DATA, payload, sizeof(payload)));
+    }
+    continueTurn(bus, motor.node);
+}
+
+static void motorRequest(simBus *bus, const frameView& frame) {
+    simMotor& motor = bus->motor;
+    const simNode& node = motor.node;
+    const uint8_t ok[] = {0x00};
+
+    if(frame.command == CMD_MOTOR_ON) {
+        milestone(bus, SIM_MOTOR_ON);
+        motor.on = true;
+        motor.quiet = false;
+        motor.lastMove = bus->now;
+        reply(bus, node, frame, NULL, 0);
+    } else if(frame.command == CMD_MOTOR_OFF) {
+        motor.on = false;
+        motor.assist = false;
+        motor.offPending = true;
+        reply(bus, node, frame, NULL, 0);
+    } else if(frame.command == CMD_ASSIST_ON || frame.command == CMD_ASSIST_OFF) {
+        updateRide(bus);
+        motor.assist = frame.command == CMD_ASSIST_ON;
+        motor.assistPending = true;
+        if(motor.assist) {
+            milestone(bus, SIM_ASSIST_ON);
+        }
+        reply(bus, node, frame, NULL, 0);
+    } else if(frame.command == CMD_SET_ASSIST_LEVEL && frame.payloadSize == 1) {
+        motor.level = frame.payload[0];
+        reply(bus, node, frame, NULL, 0);
+    } else if(frame.command == CMD_CALIBRATE) {
+        reply(bus, node, frame, NULL, 0);
+    } else if(frame.command == CMD_PUT_DATA && frame.payloadSize >= 2 && frame.payload[1] == 0xb0) {
+        milestone(bus, SIM_MOTOR_UPDATE);
+        reply(bus, node, frame, ok, sizeof(ok));
+    } else if(frame.command == CMD_PUT_DATA && frame.payloadSize == 13 && frame.payload[1] == 0x5c) {
+        memcpy(motor.slot2Serial, frame.payload + 5, 8);
+        reply(bus, node, frame, ok, sizeof(ok));
+    } else if(frame.command == CMD_GET_DATA && frame.payloadSize == 3 && frame.payload[1] == 0x5c) {
+        milestone(bus, SIM_PAIRING_CHECK);
+        uint8_t payload[12] = {0x00, frame.payload[0], frame.payload[1], 0x08};
+        memcpy(payload + 4, motor.slot2Serial, 8);
+        reply(bus, node, frame, payload, sizeof(payload));
+    } else if(frame.command == CMD_GET_DATA && frame.payloadSize == 2) {
+        uint8_t payload[] = {0x00, frame.payload[0], frame.payload[1], 0x00};
+        reply(bus, node, frame, payload, sizeof(payload));
+    } else {
+        printf("Motor: unhandled command %02x\n", frame.command);
+        reply(bus, node, frame, NULL, 0);
+    }
+}
+
+static void cu3Turn(simBus *bus) {
+    simDisplay& display = bus->display;
+    milestone(bus, SIM_FIRST_HANDOFF);
+
+    if(display.levelPending) {
+        display.levelPending = false;
+        milestone(bus, SIM_ASSIST_REQUEST);
+        uint8_t payload[] = {0x01};
+        display.node.turn.push_back(cmdReq(MSG_BMS, MSG_DISPLAY, CMD_BAT_SET_ASSIST_LEVEL, payload, sizeof(payload)));
+    }
+
+    const size_t query = display.query++ % (sizeof(cu3QuerySizes) / sizeof(cu3QuerySizes[0]));
+    display.node.turn.push_back(cmdReq(MSG_BMS, MSG_DISPLAY, CMD_GET_DATA, (uint8_t *)cu3Queries[query], cu3QuerySizes[query]));
+    continueTurn(bus, display.node);
+}
+
+static void displayRequest(simBus *bus, const frameView& frame) {
+    simDisplay& display = bus->display;
+    const simNode& node = display.node;
+
+    if(frame.command == CMD_GET_SERIAL) {
+        reply(bus, node, frame, display.serial, sizeof(display.serial));
+    } else if(bus->config.display == SIM_CU2 && frame.command == CMD_BUTTON_POLL) {
+        if(frame.payloadSize == 1 && frame.payload[0] == 0x80) {
+            milestone(bus, SIM_DISPLAY_INIT);
+        }
+        uint8_t payload[] = {0x00};
+        if(display.pressPolls > 0) {
+            // Held for one poll, released on the next, which is a short press.
+            payload[0] = display.buttons;
+            display.pressPolls--;
+        }
+        reply(bus, node, frame, payload, sizeof(payload));
+    } else if(bus->config.display == SIM_CU3 && frame.command == 0x28) {
+        milestone(bus, SIM_DISPLAY_INIT);
+        reply(bus, node, frame, NULL, 0);
+    } else {
+        // CU2 0x25, 0x26 and 0x27, CU3 0x2a, none of them need a payload in the reply.
+        reply(bus, node, frame, NULL, 0);
+    }
+}
+
+/**
+ * After pairing, and once the motor is on, the rider asks for assist.
+ */
+static void checkAssistRequest(simBus *bus) {
+    if(!bus->config.requestAssist || bus->milestones[SIM_PAIRING_CHECK] < 0 || bus->milestones[SIM_ASSIST_REQUEST] >= 0) {
+        return;
+    }
+    if(bus->config.display == SIM_CU2 && bus->display.pressPolls == 0) {
+        milestone(bus, SIM_ASSIST_REQUEST);
+        // Mode button, see buttonCheck().
+        bus->display.buttons = 0x02;
+        bus->display.pressPolls = 1;
+    } else if(bus->config.display == SIM_CU3) {
+        bus->display.levelPending = true;
+    }
+}
+
+static void handleFrame(simBus *bus, const frameView& frame) {
+    bus->framesIn++;
+    milestone(bus, SIM_FIRST_FRAME);
+
+    const bool displayPresent = bus->config.display != SIM_NO_DISPLAY;
+    simNode *node = frame.target == MSG_MOTOR ? &bus->motor.node : (frame.target == MSG_DISPLAY && displayPresent ? &bus->display.node : NULL);
+    if(node == NULL) {
+        return;
+    }
+
+    if(frame.type == MSG_HANDOFF) {
+        if(node->address == MSG_MOTOR) {
+            motorTurn(bus);
+        } else if(bus->config.display == SIM_CU3) {
+            cu3Turn(bus);
+        }
+    } else if(frame.type == MSG_PING_REQ) {
+        send(bus, pingResp(frame.source, node->address), nodeDelay(bus, *node));
+    } else if(frame.type == MSG_CMD_REQ) {
+        if(node->address == MSG_MOTOR) {
+            motorRequest(bus, frame);
+        } else {
+            displayRequest(bus, frame);
+        }
+    } else if(frame.type == MSG_CMD_RESP && node->awaiting) {
+        // The BMS answered, go on with our turn.
+        continueTurn(bus, *node);
+    }
+
+    checkAssistRequest(bus);
+}
+
+void simInit(simBus *bus, const simConfig& config) {
+    *bus = {};
+    bus->config = config;
+    parserInit(&bus->parser);
+    for(int64_t& time : bus->milestones) {
+        time = -1;
+    }
+
+    bus->motor.node.address = MSG_MOTOR;
+    memset(bus->motor.slot2Serial, 0xff, sizeof(bus->motor.slot2Serial));
+
+    bus->display.node.address = MSG_DISPLAY;
+    const uint8_t serial[] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0};
+    memcpy(bus->display.serial, serial, sizeof(serial));
+
+    inProcessBus = bus;
+}
+
+void simWakeup(simBus *bus, int64_t now) {
+    bus->now = now;
+    milestone(bus, SIM_WAKEUP);
+    const int64_t time = (now > bus->busFreeAt ? now : bus->busFreeAt) + SIM_BYTE_US;
+    bus->out.push_back({time, 0x00});
+    bus->busFreeAt = time;
+    const uint8_t wakeup = 0x00;
+    logFrame(bus, "<<", &wakeup, 1);
+}
+
+void simFromBms(simBus *bus, const uint8_t *data, size_t length, int64_t now) {
+    bus->now = now;
+    if(bus->busFreeAt < now) {
+        bus->busFreeAt = now;
+    }
+
+    size_t pos = 0;
+    while(pos < length) {
+        pos += parserWrite(&bus->parser, data + pos, length - pos);
+
+        frameView frame;
+        readResult result;
+        while((result = parserNext(&bus->parser, &frame)) != MSG_CONTINUE) {
+            if(result == MSG_CRC_ERROR) {
+                bus->crcErrors++;
+            } else if(result == MSG_OK) {
+                if(bus->config.verbose) {
+                    uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+                    messageType message = {frame.target, frame.source, frame.type, frame.command, {}, frame.payloadSize};
+                    memcpy(message.payload, frame.payload, frame.payloadSize);
+                    logFrame(bus, ">>", encoded, encodeMessage(message, encoded));
+                }
+                handleFrame(bus, frame);
+                parserRelease(&bus->parser);
+            }
+        }
+    }
+}
+
+size_t simToBms(simBus *bus, uint8_t *out, size_t max, int64_t now) {
+    size_t count = 0;
+    while(count < max && !bus->out.empty() && bus->out.front().time <= now) {
+        out[count++] = bus->out.front().value;
+        bus->out.pop_front();
+    }
+    return count;
+}
+
+int64_t simNextByteTime(const simBus *bus) {
+    return bus->out.empty() ? -1 : bus->out.front().time;
+}
+
+bool simAssistOn(const simBus *bus) {
+    return bus->motor.assist;
+}
+
+void simReport(const simBus *bus) {
+    const int64_t wakeup = bus->milestones[SIM_WAKEUP];
+    printf("Milestones (ms after wakeup):\n");
+    for(int which = 0; which < SIM_MILESTONES; which++) {
+        if(bus->milestones[which] < 0 || wakeup < 0) {
+            printf("  %-15s -\n", milestoneNames[which]);
+        } else {
+            printf("  %-15s %9.1f\n", milestoneNames[which], (bus->milestones[which] - wakeup) / 1000.0);
+        }
+    }
+    printf("Frames from BMS: %u, to BMS: %u, CRC errors: %u\n", bus->framesIn, bus->framesOut, bus->crcErrors);
+    printf("Motor: %s, assist %s, level %u, distance %.0f m\n", bus->motor.on ? "on" : "off", bus->motor.assist ? "on" : "off", bus->motor.level,
+           bus->motor.distance * 10);
+}
+
+void transportWrite(const uint8_t *data, size_t length) {
+    if(inProcessBus != NULL) {
+        // The in-process BMS sends at the current simulation time.
+        simFromBms(inProcessBus, data, length, inProcessBus->now);
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include "message.h"
+#include "parser.h"
+
+/**
+ * Simulation of the other nodes on the bus: motor, and a CU2 or CU3 display.
+ * The firmware (the BMS, 0x02) is on the other side, bytes from it go in with simFromBms(..),
+ * bytes for it come out of simToBms(..), timed as they would be on the bus at 9600 baud.
+ * Time is passed in by the caller, so it can be real time (bus_sim) or virtual time.
+ *
+ * The library also implements transportWrite(..), feeding the bus from simInit(..),
+ * so protocol code linked into the same process talks to the simulation directly.
+ */
+
+// Time one byte takes on the bus: start bit, 8 data bits, stop bit at 9600 baud.
+#define SIM_BYTE_US (10 * 1000 * 1000 / 9600)
+
+enum simDisplayType { SIM_NO_DISPLAY, SIM_CU2, SIM_CU3 };
+
+struct simConfig {
+    simDisplayType display;
+    // Time nodes take before they start replying.
+    int64_t motorDelayUs;
+    int64_t displayDelayUs;
+    // Ask for assist level 1 through the display, once the motor is on and paired.
+    bool requestAssist;
+    // Print every frame.
+    bool verbose;
+};
+
+// Points in the wake-up sequence we measure, relative to the wakeup byte.
+enum simMilestone {
+    SIM_WAKEUP,
+    SIM_FIRST_FRAME,
+    SIM_DISPLAY_INIT,
+    SIM_MOTOR_ON,
+    SIM_MOTOR_UPDATE,
+    SIM_FIRST_HANDOFF,
+    SIM_PAIRING_CHECK,
+    SIM_ASSIST_REQUEST,
+    SIM_ASSIST_ON,
+    SIM_MILESTONES
+};
+
+// A node that gets control with a handoff, sends a few requests to the BMS, and hands control back.
+struct simNode {
+    uint8_t address;
+    // Requests still to send this turn.
+    std::deque<messageType> turn;
+    // Waiting for the BMS to answer the last request.
+    bool awaiting;
+};
+
+struct simMotor {
+    simNode node;
+    bool on;
+    bool assist;
+    uint8_t level;
+    // Send CMD_BAT_STATUS_MOTOR_OFF next turn, and go quiet after.
+    bool offPending;
+    bool quiet;
+    // Send CMD_BAT_STATUS_ASSIST next turn.
+    bool assistPending;
+    uint8_t slot2Serial[8];
+    uint16_t speed;
+    double distance;
+    int64_t lastMove;
+    int64_t lastPut;
+};
+
+struct simDisplay {
+    simNode node;
+    uint8_t serial[8];
+    // CU2 buttons to report on the next poll(s).
+    uint8_t buttons;
+    uint8_t pressPolls;
+    // CU3 query to send next turn.
+    size_t query;
+    bool levelPending;
+};
+
+struct simByte {
+    int64_t time;
+    uint8_t value;
+};
+
+struct simBus {
+    simConfig config;
+    bowParser parser;
+    std::deque<simByte> out;
+    // When the last scheduled byte is off the bus.
+    int64_t busFreeAt;
+    int64_t now;
+    simMotor motor;
+    simDisplay display;
+    int64_t milestones[SIM_MILESTONES];
+    uint32_t framesIn;
+    uint32_t framesOut;
+    uint32_t crcErrors;
+};
+
+void simInit(simBus *bus, const simConfig& config);
+
+/**
+ * Send the '0x00' wakeup byte, like a display does when connected or on a button press.
+ */
+void simWakeup(simBus *bus, int64_t now);
+
+/**
+ * Bytes sent by the BMS, received at the given time.
+ */
+void simFromBms(simBus *bus, const uint8_t *data, size_t length, int64_t now);
+
+/**
+ * Bytes for the BMS that are on the bus by the given time, returns how many were copied to out.
+ */
+size_t simToBms(simBus *bus, uint8_t *out, size_t max, int64_t now);
+
+/**
+ * Time of the next byte for the BMS, or -1 if there is none.
+ */
+int64_t simNextByteTime(const simBus *bus);
+
+bool simAssistOn(const simBus *bus);
+
+/**
+ * Print the milestones and frame counts.
+ */
+void simReport(const simBus *bus);
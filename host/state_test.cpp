@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <random>
+#include "bow.h"
+#include "clock.h"
+#include "clock_host.h"
+#include "cu3.h"
+#include "data.h"
+#include "machine.h"
+#include "scheduler.h"
+#include "states.h"
+
+/**
+ * Randomized ride, charge and idle scenarios on virtual time, through the state machine and the scheduler.
+ * The motor on and charging states, and the CU3 clock, are the firmware's. The other states, the motor,
+ * the display and the bus are stand-ins that only do what those need, see below.
+ * Checks the 10 s standstill timeout with the motor on, the 3 s charger delay and the CU3 time offset,
+ * and that periodic jobs run within their periods. Each scenario is seeded with its number, so a failure reruns the same.
+ * Usage: state_test [scenarios]
+ */
+
+// Longest a step and the jobs after it take with the bus, a control window and a handoff round.
+#define BUSY_STEP_MAX_US (120 * 1000)
+// Same as the main task.
+#define PARKED_WAIT_US (1000 * 1000)
+
+#define STANDSTILL_US (10 * 1000 * 1000)
+#define CHARGER_DELAY_US (3 * 1000 * 1000)
+// The motor off stand-in gives up on handoffs after this long without a wakeup.
+#define MOTOR_OFF_QUIET_US (2 * 1000 * 1000)
+
+// Stands in for the speed the motor reports, and the display updates.
+#define SPEED_REPORT_MIN_MS 200
+#define SPEED_REPORT_MAX_MS 300
+#define DISPLAY_UPDATE_MIN_MS 500
+#define DISPLAY_UPDATE_MAX_MS 1000
+
+static int failures = 0;
+
+#define CHECK(condition, scenario)                                                                               \
+    do {                                                                                                         \
+        if(!(condition)) {                                                                                       \
+            fprintf(stderr, "%s:%d: scenario %u: check failed: %s\n", __FILE__, __LINE__, scenario, #condition); \
+            failures++;                                                                                          \
+        }                                                                                                        \
+    } while(0)
+
+// What the rider does, the stand-ins read it.
+static uint16_t riderSpeed = 0;
+
+/**
+ * When each job last ran, to check the gaps between runs. 0 when it (re)started since.
+ */
+struct jobRuns {
+    int64_t lastRun;
+    // Asked to run early since it last ran, the gap may be shorter than its period.
+    bool requested;
+    int64_t longestGapUs;
+    bool early;
+    uint32_t runs;
+};
+
+static jobRuns runs[JOBS];
+
+static void jobRan(jobId id) {
+    jobRuns& job = runs[id];
+    const int64_t now = clockNowUs();
+    if(job.lastRun != 0) {
+        const int64_t gap = now - job.lastRun;
+        if(gap > job.longestGapUs) {
+            job.longestGapUs = gap;
+        }
+        if(gap < (int64_t)schedulerGet(id)->minPeriodMs * 1000 && !job.requested) {
+            job.early = true;
+        }
+    }
+    job.lastRun = now;
+    job.requested = false;
+    job.runs++;
+}
+
+static void jobRestarted(jobId id) {
+    runs[id].lastRun = 0;
+    runs[id].requested = false;
+}
+
+static void speedReportJob(void *context) {
+    ((ion_state *)context)->speed = riderSpeed;
+    jobRan(JOB_MOTOR_UPDATE);
+}
+
+static void displayUpdateJob(void *context) {
+    jobRan(JOB_DISPLAY_UPDATE);
+}
+
+// The hardware and the bus, as far as the real states use them.
+
+void setRelay(bool value) {}
+bool getLight() { return false; }
+void queueBlink(size_t blinks, uint32_t onTime, uint32_t offTime) {}
+size_t dropEvents() { return 0; }
+void exchange(const messageType& outMessage) {}
+readResult exchange(const messageType& outMessage, frameView *inMessage) { return MSG_OK; }
+uint32_t getTotal() { return 0; }
+uint8_t getBatPercentage() { return 50; }
+
+void startMotorUpdates() {
+    if(!schedulerGet(JOB_MOTOR_UPDATE)->active) {
+        jobRestarted(JOB_MOTOR_UPDATE);
+    }
+    schedulerStart(JOB_MOTOR_UPDATE);
+}
+
+void stopMotorUpdates() {
+    schedulerStop(JOB_MOTOR_UPDATE);
+    jobRestarted(JOB_MOTOR_UPDATE);
+}
+
+void requestDisplayUpdate() {
+    runs[JOB_DISPLAY_UPDATE].requested = true;
+    schedulerRequest(JOB_DISPLAY_UPDATE);
+}
+
+void startDisplayUpdates() {
+    if(!schedulerGet(JOB_DISPLAY_UPDATE)->active) {
+        jobRestarted(JOB_DISPLAY_UPDATE);
+    }
+    schedulerStart(JOB_DISPLAY_UPDATE);
+}
+
+static void stopDisplayUpdates() {
+    schedulerStop(JOB_DISPLAY_UPDATE);
+    jobRestarted(JOB_DISPLAY_UPDATE);
+}
+
+// The other states, each a step or a few of what the firmware does on the bus.
+
+void enterIdleState(ion_state * state) {
+    state->doHandoffs = false;
+    state->displayOn = false;
+    stopDisplayUpdates();
+}
+
+void handleIdleState(ion_state * state, const state_inputs& inputs) {
+    if(inputs.wakeup) {
+        stateEvent(state, EV_WAKEUP);
+    }
+}
+
+void enterTurnMotorOnState(ion_state * state) {
+    state->doHandoffs = true;
+    state->displayOn = true;
+    state->wokenAt = clockNowUs();
+}
+
+void handleTurnMotorOnState(ion_state * state, const state_inputs& inputs) {
+    // Motor on, then the display, then assist off.
+    if(state->step < 2) {
+        state->step++;
+        return;
+    }
+    state->assistOn = true;
+    startMotorUpdates();
+    startDisplayUpdates();
+    stateEvent(state, EV_DONE);
+}
+
+void enterCalibrateState(ion_state * state) {}
+
+void handleCalibrateState(ion_state * state, const state_inputs& inputs) {
+    stateEvent(state, EV_DONE);
+}
+
+void enterSetAssistLevelState(ion_state * state) {}
+
+void handleSetAssistLevelState(ion_state * state, const state_inputs& inputs) {
+    state->levelSet = state->level;
+    requestDisplayUpdate();
+    stateEvent(state, EV_DONE);
+}
+
+void enterTurnMotorOffState(ion_state * state) {
+    stopMotorUpdates();
+}
+
+void handleTurnMotorOffState(ion_state * state, const state_inputs& inputs) {
+    state->assistOn = false;
+    stateEvent(state, EV_DONE);
+}
+
+void enterMotorOffState(ion_state * state) {
+    state->displayOn = false;
+    requestDisplayUpdate();
+}
+
+void handleMotorOffState(ion_state * state, const state_inputs& inputs) {
+    if(inputs.modeShortPress || inputs.wakeup) {
+        stateEvent(state, EV_WAKEUP);
+        return;
+    }
+    if(state->doHandoffs && clockNowUs() - stateEnteredAt() > MOTOR_OFF_QUIET_US) {
+        // Like the main task when nobody answers our handoffs anymore.
+        state->doHandoffs = false;
+        stateEvent(state, EV_QUIET);
+    }
+}
+
+/**
+ * Same as the main task.
+ */
+static bool isParked(const ion_state * state) {
+    return !state->doHandoffs && (state->state == IDLE || state->state == MOTOR_OFF || state->state == CHARGING);
+}
+
+enum riderPhase { PHASE_IDLE, PHASE_RIDE, PHASE_CHARGE, PHASES };
+
+// Totals over all scenarios, to make sure the checks were not vacuous.
+static uint32_t standstills = 0;
+static uint32_t chargerOuts = 0;
+static uint32_t timeChecks = 0;
+
+/**
+ * The CU3 sets the time, and later asks for it, both through the data items as they are on the bus.
+ */
+static void putTime(ion_state * state, uint32_t seconds) {
+    uint8_t buffer[8];
+    dataWriter writer;
+    dataWriterInit(&writer, buffer, sizeof(buffer));
+    dataWriteUint(&writer, DATA_TIME, seconds);
+
+    dataReader reader;
+    dataReaderInit(&reader, buffer, writer.size);
+    dataItem item;
+    if(dataReadValue(&reader, &item)) {
+        cu3PutTime(item, state);
+    }
+}
+
+static bool getTime(uint32_t *seconds) {
+    uint8_t buffer[8];
+    dataWriter writer;
+    dataWriterInit(&writer, buffer, sizeof(buffer));
+    dataItem request = {};
+    request.id = DATA_TIME;
+    if(!cu3GetTime(&writer, request)) {
+        return false;
+    }
+
+    dataReader reader;
+    dataReaderInit(&reader, buffer, writer.size);
+    dataItem item;
+    if(!dataReadValue(&reader, &item) || item.id != DATA_TIME) {
+        return false;
+    }
+    *seconds = dataUint(item);
+    return true;
+}
+
+static void runScenario(uint32_t scenario) {
+    std::mt19937 random(scenario);
+    auto between = [&random](int64_t low, int64_t high) { return std::uniform_int_distribution<int64_t>(low, high)(random); };
+    auto chance = [&random](double probability) { return std::bernoulli_distribution(probability)(random); };
+
+    // Anywhere in the first days after boot, the CU3 offset wraps at 24h.
+    const int64_t start = between(0, 3LL * 24 * 60 * 60) * 1000 * 1000 + between(0, 999999);
+    clockUseVirtual(start);
+    const int64_t end = start + between(60, 300) * 1000 * 1000;
+
+    for(int id = 0; id < JOBS; id++) {
+        runs[id] = {};
+    }
+    schedulerAdd(JOB_MOTOR_UPDATE, speedReportJob, 2, SPEED_REPORT_MIN_MS, SPEED_REPORT_MAX_MS);
+    schedulerAdd(JOB_DISPLAY_UPDATE, displayUpdateJob, 1, DISPLAY_UPDATE_MIN_MS, DISPLAY_UPDATE_MAX_MS);
+
+    ion_state state = {};
+    state.state = IDLE;
+    riderSpeed = 0;
+    stateInit(&controlMachine, &state);
+
+    // What the rider does, and until when.
+    riderPhase phase = PHASE_IDLE;
+    int64_t phaseEnd = start;
+    int64_t nextChange = start;
+    bool chargePin = false;
+    bool wakeup = false;
+
+    // Our own idea of when the firmware should act, from what it was told.
+    int64_t enteredAt = start;
+    int64_t lastMoving = start;
+    bool timeSet = false;
+    uint32_t timeSetTo = 0;
+    int64_t timeSetAt = 0;
+
+    while(clockNowUs() < end) {
+        const int64_t now = clockNowUs();
+
+        if(now >= phaseEnd) {
+            phase = (riderPhase)between(0, PHASES - 1);
+            phaseEnd = now + between(1, 60) * 1000 * 1000;
+            nextChange = now;
+            riderSpeed = 0;
+            chargePin = phase == PHASE_CHARGE;
+            wakeup = phase == PHASE_RIDE;
+        }
+        if(now >= nextChange) {
+            if(phase == PHASE_RIDE) {
+                // Ride a while, or stand still a while, sometimes long enough for the motor to go off.
+                if(riderSpeed == 0 && chance(0.6)) {
+                    riderSpeed = between(30, 300);
+                    nextChange = now + between(1000, 30000) * 1000;
+                    wakeup = true;
+                } else {
+                    riderSpeed = 0;
+                    nextChange = now + between(0, 20000) * 1000;
+                }
+            } else if(phase == PHASE_CHARGE) {
+                // Unplug for a bit now and then, sometimes shorter than the charger delay.
+                chargePin = !chargePin;
+                nextChange = now + (chargePin ? between(500, 20000) : between(100, 6000)) * 1000;
+            } else {
+                nextChange = phaseEnd;
+            }
+        }
+
+        if(chance(0.002)) {
+            timeSetTo = (uint32_t)between(0, 24 * 60 * 60 - 1);
+            timeSetAt = now;
+            timeSet = true;
+            putTime(&state, timeSetTo);
+        }
+        if(timeSet && chance(0.05)) {
+            uint32_t seconds = 0;
+            CHECK(getTime(&seconds), scenario);
+            const int64_t elapsed = now / (1000 * 1000) - timeSetAt / (1000 * 1000);
+            CHECK(seconds == (timeSetTo + elapsed) % (24 * 60 * 60), scenario);
+            timeChecks++;
+        }
+
+        const control_state before = state.state;
+        if(chargePin) {
+            stateEvent(&state, EV_CHARGER_IN);
+        }
+        state_inputs inputs = {
+            .modeShortPress = phase == PHASE_RIDE && chance(0.002),
+            .lightLongPress = false,
+            .calibrate = phase == PHASE_RIDE && chance(0.0005),
+            .wakeup = wakeup,
+            .chargePin = chargePin,
+        };
+        wakeup = false;
+        if(state.state != before) {
+            enteredAt = now;
+        }
+
+        // What the step should do, from what the firmware was told.
+        const control_state stepped = state.state;
+        if(stepped == MOTOR_ON && (state.speed > 0 || state.levelSet != 0)) {
+            lastMoving = now;
+        }
+        const bool standingStill = stepped == MOTOR_ON && now - lastMoving > STANDSTILL_US;
+        const bool unplugged = stepped == CHARGING && !chargePin && now - enteredAt > CHARGER_DELAY_US;
+
+        stateStep(&state, inputs);
+
+        if(stepped == MOTOR_ON) {
+            CHECK((state.state == TURN_MOTOR_OFF) == standingStill, scenario);
+            standstills += standingStill;
+        }
+        if(stepped == CHARGING) {
+            CHECK((state.state == TURN_MOTOR_ON) == unplugged, scenario);
+            chargerOuts += unplugged;
+        }
+        if(state.state != stepped) {
+            enteredAt = now;
+        }
+        if(state.state == MOTOR_ON && stepped != MOTOR_ON) {
+            lastMoving = now;
+        }
+
+        schedulerRun(&state, state.doHandoffs ? now + BUSY_STEP_MAX_US : INT64_MAX);
+
+        if(isParked(&state)) {
+            // Sleep until a job is due, or the rider does something.
+            int64_t wake = schedulerNextDue();
+            if(wake > now + PARKED_WAIT_US) {
+                wake = now + PARKED_WAIT_US;
+            }
+            if(wake > nextChange) {
+                wake = nextChange;
+            }
+            if(wake > phaseEnd) {
+                wake = phaseEnd;
+            }
+            clockAdvanceTo(wake);
+        } else {
+            clockAdvanceUs(between(1000, BUSY_STEP_MAX_US));
+        }
+        if(clockNowUs() == now) {
+            clockAdvanceUs(1000);
+        }
+    }
+
+    // Jobs never waited longer than their period, plus the step that was busy when they became due.
+    for(const jobId id : {JOB_MOTOR_UPDATE, JOB_DISPLAY_UPDATE}) {
+        CHECK(!runs[id].early, scenario);
+        CHECK(runs[id].longestGapUs <= (int64_t)schedulerGet(id)->maxPeriodMs * 1000 + BUSY_STEP_MAX_US, scenario);
+    }
+}
+
+int main(int argc, char **argv) {
+    const uint32_t scenarios = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000;
+    for(uint32_t scenario = 0; scenario < scenarios; scenario++) {
+        runScenario(scenario);
+    }
+    printf("%u scenarios, %u standstills, %u times unplugged, %u clock reads\n", scenarios, standstills, chargerOuts, timeChecks);
+    CHECK(scenarios == 0 || (standstills > 0 && chargerOuts > 0 && timeChecks > 0), scenarios);
+    return failures == 0 ? 0 : 1;
+}
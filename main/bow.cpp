@@ -1,11 +1,20 @@
 #include <string.h>
 #include <sys/unistd.h>
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "soc/uart_reg.h"
 #include "esp_log.h"
-#include "crc8.h"
+#include "clock.h"
+#include "cmds.h"
+#include "rtt.h"
+#include "bus_stats.h"
+#include "presence.h"
+#include "trace.h"
+#include "transport.h"
+#include "ctrl_event_group.h"
 #include "bow.h"
 
 static const char *TAG = "bow";
@@ -14,35 +23,143 @@ static const char *TAG = "bow";
 #define TXD_PIN (CONFIG_ION_TXD)
 #define RXD_PIN (CONFIG_ION_RXD)
 
+#define BAUD_RATE (9600)
+// Time one byte takes on the bus: start bit, 8 data bits, stop bit.
+#define BYTE_US (10 * 1000 * 1000 / BAUD_RATE)
+
 #define RX_BUF_SIZE (1024)
+// Room for a few frames, so writing returns at once. The driver needs more than the hardware FIFO (128 bytes), or none.
+#define TX_BUF_SIZE (512)
+
+// Events from the UART driver, mostly 'data received'.
+#define UART_QUEUE_SIZE (20)
+// Parsed frames/wakeups/errors waiting for the application.
+// The parser needs a free slot for the frame it's parsing, and one for the frame the application is looking at.
+// So a full queue stops the receive task before the parser runs out of slots.
+#define RX_QUEUE_SIZE (PARSER_FRAME_SLOTS - 2)
+// Above the application task, so incoming bytes are parsed as soon as they arrive.
+#define RX_TASK_PRIORITY (10)
+
+// Longest wait for a response when the caller does not limit it.
+#define EXCHANGE_DEADLINE_US ((int64_t)CONFIG_ION_EXCHANGE_DEADLINE_MS * 1000)
+
+static QueueHandle_t uartQueue;
+static QueueHandle_t rxQueue;
+
+static requestHandler onRequest = NULL;
+static void *onRequestContext = NULL;
+
+// When the last byte written will have left the UART, only used by the task writing to the bus.
+static int64_t txEnd = 0;
+
+// Only used by the receive task, the application gets views into its frames through rxQueue, and releases them.
+static bowParser parser;
+
+// Set while the application has the view of the last MSG_OK event it got, it's released on the next read.
+static bool holdingFrame = false;
+
+static void pushEvent(readResult result, const frameView& frame) {
+    rxEvent event = {};
+    event.result = result;
+    event.time = clockNowUs();
+    if(result == MSG_OK) {
+        event.message = frame;
+        statsRxFrame(frame);
+    } else if(result == MSG_CRC_ERROR) {
+        statsAdd(STAT_CRC_ERRORS);
+    } else if(result == MSG_WAKEUP) {
+        statsAdd(STAT_WAKEUPS);
+    }
+
+    if(xQueueSend(rxQueue, &event, 0) != pdTRUE) {
+        // The application is behind. Wait for it instead of dropping the event, the parser may not move on
+        // past frames it still has views of. Meanwhile, new bytes wait in the UART driver.
+        statsAdd(STAT_RX_STALLS);
+        setControlBits(BUS_RX_BIT);
+        xQueueSend(rxQueue, &event, portMAX_DELAY);
+    }
+    // Wakes up the main loop if it's waiting for something to do.
+    setControlBits(BUS_RX_BIT);
+}
+
+/**
+ * Receive task, reads bytes as the UART driver reports them straight into the parser.
+ * Complete messages, wakeups and CRC errors are queued for readEvent(..), in order.
+ * The parser keeps its state between reads, so no bytes are lost between messages.
+ */
+static void rxTask(void *pvParameter) {
+    // Incomplete frames already added to the statistics.
+    uint32_t incompleteCounted = 0;
 
-struct parserState {
-    // Are we holding the last byte to check if it's escaped.
-    bool escaping;
+    while(true) {
+        uart_event_t uartEvent;
+        if(xQueueReceive(uartQueue, &uartEvent, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
 
-    // We found a unescaped 0x10, indicating start of message.
-    bool started;
+        if(uartEvent.type == UART_FIFO_OVF || uartEvent.type == UART_BUFFER_FULL) {
+            // We fell behind, whatever is buffered is incomplete. Start over.
+            ESP_LOGW(TAG, "UART overflow (%d), flushing input", uartEvent.type);
+            statsAdd(STAT_UART_OVERFLOWS);
+            uart_flush_input(UART_NUM);
+            xQueueReset(uartQueue);
+            parserReset(&parser);
+            continue;
+        }
 
-    // Payload length is indicated by one nibble, so max value 0xF (15).
-    // Payload length excludes the starting byte, 2 header bytes, command byte, and crc byte.
-    // So total length = payload + 5, and max length is 15 + 5 = 20.
-    uint8_t data[20];
-    uint8_t length; // readPos?
+        if(uartEvent.type != UART_DATA) {
+            continue;
+        }
 
-    // Header values.
-    uint8_t target;
-    uint8_t source;
-    int8_t type;
-    int8_t size;
-};
+        // Read everything there is, this might include bytes from later data events, those will then find nothing to read.
+        while(true) {
+            size_t rxReady = 0;
+            ESP_ERROR_CHECK(uart_get_buffered_data_len(UART_NUM, &rxReady));
+            if(rxReady == 0) {
+                break;
+            }
 
-static uint8_t nibbles(uint8_t left, uint8_t right) {
-    return (uint8_t) (right | (left << 4));
+            size_t space = 0;
+            uint8_t *buffer = parserWriteBuffer(&parser, &space);
+            if(space == 0) {
+                // Only when the parser is out of slots, which the queue size should prevent. Leave the bytes in the driver.
+                break;
+            }
+            const int rxBytes = uart_read_bytes(UART_NUM, buffer, rxReady < space ? rxReady : space, 0);
+            if(rxBytes > 0) {
+#if CONFIG_ION_TRACE
+                traceRecord(TRACE_RX, buffer, rxBytes);
+#endif
+                parserCommit(&parser, rxBytes);
+            }
+
+            frameView frame;
+            readResult result;
+            while((result = parserNext(&parser, &frame)) != MSG_CONTINUE) {
+                pushEvent(result, frame);
+            }
+        }
+
+        if(parser.incomplete != incompleteCounted) {
+            statsAdd(STAT_INCOMPLETE, parser.incomplete - incompleteCounted);
+            incompleteCounted = parser.incomplete;
+        }
+    }
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * Set who answers requests addressed to us that arrive during an exchange, NULL to ignore them.
+ */
+void setRequestHandler(requestHandler handler, void *context) {
+    onRequest = handler;
+    onRequestContext = context;
 }
 
 void initUart() {
     uart_config_t uart_config = {};
-    uart_config.baud_rate = 9600;
+    uart_config.baud_rate = BAUD_RATE;
     uart_config.data_bits = UART_DATA_8_BITS;
     uart_config.parity = UART_PARITY_DISABLE;
     uart_config.stop_bits = UART_STOP_BITS_1;
@@ -56,240 +173,270 @@ void initUart() {
     uart_intr.rx_timeout_thresh = 10;
     uart_intr.txfifo_empty_intr_thresh = 10;
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_NUM, RX_BUF_SIZE * 2, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(UART_NUM, RX_BUF_SIZE * 2, TX_BUF_SIZE, UART_QUEUE_SIZE, &uartQueue, 0));
     ESP_ERROR_CHECK(uart_param_config(UART_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_intr_config(UART_NUM, &uart_intr));
     ESP_ERROR_CHECK(uart_set_pin(UART_NUM, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+    parserInit(&parser);
+    rxQueue = xQueueCreate(RX_QUEUE_SIZE, sizeof(rxEvent));
+
+    // Same core as the caller, which is where the UART interrupt was installed.
+    xTaskCreatePinnedToCore(rxTask, "rxTask", 4096, NULL, RX_TASK_PRIORITY, NULL, xPortGetCoreID());
 }
 
 /**
- * @brief Parse a single message input byte.
- *
- * @param value the byte
- * @param message the current message state
+ * Anyone we hear from is on the bus. Handoff messages have no source.
  */
-readResult parseByte(uint8_t value, parserState *state) {
-    uint8_t low = value & 0x0f;
-    uint8_t high = value >> 4;
-
-    if(state->length == 0) {
-        // First byte in a new message, always 0x10.
-        // We could check it, but that's already handled by the caller.
-        // We still need it, to calculate the crc.
-    } else if(state->length == 1) {
-        // First nibble is always message target.
-        state->target = high;
-        // Second nibble is always message type.
-        state->type = low;
-    } else if(state->length == 2) {
-        if(state->type == MSG_HANDOFF) {
-            state->size = 3;
-        } else {
-            state->source = high;
-            if(state->type == MSG_PING_RESP || state->type == MSG_PING_REQ) {
-                state->size = 4;
-            } else {
-                state->size = low + 5;
-            }
-        }
+static void notePresence(const rxEvent& event) {
+    if(event.result == MSG_OK && event.message.type != MSG_HANDOFF) {
+        presenceSeen(event.message.source, event.time);
     }
+}
 
-    state->data[state->length++] = value;
+/**
+ * Take the next event from the receive task, waiting at most the given ticks.
+ * The frame of the previous event is released first, its view is no longer valid after this.
+ */
+static bool receiveEvent(rxEvent *event, TickType_t wait) {
+    if(holdingFrame) {
+        parserRelease(&parser);
+        holdingFrame = false;
+    }
+    if(xQueueReceive(rxQueue, event, wait) != pdTRUE) {
+        return false;
+    }
+    holdingFrame = event->result == MSG_OK;
+    notePresence(*event);
+    return true;
+}
 
-    if(state->length > 2 && state->length == state->size) {
-        uint8_t crc = crc8_bow(state->data, state->length - 1);
-        if(crc != state->data[state->length - 1]) {
-            ESP_LOGI(TAG, "CRC error, message:");
-            ESP_LOG_BUFFER_HEX(TAG, state->data, state->length);
-            return MSG_CRC_ERROR;
-        }
-        return MSG_OK;
+/**
+ * Wait for the next event from the receive task.
+ * Will return:
+ * - MSG_TIMEOUT   if timeout > 0 and nothing was received in the given time.
+ *                 Unlike a silent bus, this also happens while a message is still incomplete.
+ * - MSG_WAKEUP    if a single 0x00 byte was received, which is used as a 'wakeup' signal
+ * - MSG_CRC_ERROR if a message with an invalid crc value was read
+ * - MSG_OK        if a full message was read with correct CRC
+ * The event time is when the receive task finished parsing it.
+ * The payload of a received message points into the parser, and is only valid until the next read,
+ * by this, pollEvent(..) or exchangePoll(..). The parser does not reuse its slot before that.
+ */
+readResult readEvent(rxEvent *event, TickType_t timeout) {
+    if(!receiveEvent(event, timeout > 0 ? timeout : portMAX_DELAY)) {
+        return MSG_TIMEOUT;
     }
+    return event->result;
+}
 
-    return MSG_CONTINUE;
+/**
+ * Like readEvent(..), but returns MSG_TIMEOUT at once when nothing is queued.
+ * Call until it does, it resets BUS_RX_BIT so only events after that set it again.
+ */
+readResult pollEvent(rxEvent *event) {
+    clearControlBits(BUS_RX_BIT);
+    if(!receiveEvent(event, 0)) {
+        return MSG_TIMEOUT;
+    }
+    return event->result;
 }
 
-readResult handleByte(uint8_t value, parserState *state) {
-    if(state->started) {
-        // Not a message start byte, and we're not escaping, so just parse it normally.
-        return parseByte(value, state);
-    } else if(value == 0x00) {
-        // Single 0x00 with no leading 0x10, which is sent by display to wake up system.
-        return MSG_WAKEUP;
-    } else {
-        // Unexpected bytes, continue till we find a 0x10 or 0x00
-        return MSG_CONTINUE;
+/**
+ * Drop whatever is queued, for when nobody listens to the bus. Returns how many events were dropped.
+ */
+size_t dropEvents() {
+    size_t dropped = 0;
+    rxEvent event;
+    while(pollEvent(&event) != MSG_TIMEOUT) {
+        dropped++;
     }
+    return dropped;
 }
 
 /**
- * Deals with message framing, (re)starts a message on a unescaped 0x10,
- * and converts escaped 0x10s to single 0x10s
+ * Read a single message from the bus, see readEvent(..) for the results.
  */
-readResult handleFraming(uint8_t value, parserState *state) {
-    if(state->escaping) {
-        state->escaping = false;
-        if(value == 0x10) {
-            // Escaped 0x10, don't reset and just parse the value.
-            return handleByte(0x10, state);
-        }
+readResult readMessage(frameView *message, TickType_t timeout) {
+    rxEvent event;
+    readResult result = readEvent(&event, timeout);
+    if(result == MSG_OK) {
+        *message = event.message;
+    }
+    return result;
+}
 
-        // Non escaped 0x10, start of message.
-        if(state->length != 0) {
-            // We already were reading a message which we didn't get fully.
-            // Ignore it and reset state.
-            if(state->length > 0) {
-                ESP_LOGI(TAG, "Incomplete message:");
-                ESP_LOG_BUFFER_HEX(TAG, state->data, state->length);
-            }
-            *state = {};
-        }
+readResult readMessage(frameView *message) { return readMessage(message, 0); }
 
-        state->started = true;
-        // Record the start byte, no need to check result since it's always MSG_CONTINUE.
-        handleByte(0x10, state);
-        // First content byte of the message.
-        return handleByte(value, state);
-    } else if(value == 0x10) {
-        state->escaping = true;
-        // Message start byte, we need to check the next input byte to decide what to do.
-        return MSG_CONTINUE;
-    } else {
-        return handleByte(value, state);
-    }
+/**
+ * Queue bytes for sending, returns at once unless the TX buffer is full.
+ * The bytes are on the bus back to back after anything written before, see txDoneUs().
+ */
+void transportWrite(const uint8_t *data, size_t length) {
+#if CONFIG_ION_TRACE
+    traceRecord(TRACE_TX, data, length);
+#endif
+    const int64_t now = clockNowUs();
+    txEnd = (txEnd > now ? txEnd : now) + (int64_t)length * BYTE_US;
+    uart_write_bytes(UART_NUM, data, length);
 }
 
 /**
- * Read a single message from the bus.
- * Will return:
- * - MSG_TIMEOUT   if timeout > 0 and the timeout expires between starting to read part of the message
- *                 and receiving any bytes. So the bus has to be silent for the given time
- * - MSG_WAKEUP    if a single 0x00 byte is received, which is used as a 'wakeup' signal
- * - MSG_CRC_ERROR if a message with an invalid crc value was read
- * - MSG_OK        if a full message was read with correct CRC
+ * When everything written so far will have been sent, in microseconds since boot, or now if it already was.
+ * Waiting for a response should start from here, not from when the request was written.
+ * Worked out from the baud rate, the driver does not tell us when its TX buffer ran empty.
  */
-readResult readMessage(messageType *message, TickType_t timeout) {
-    uint8_t data[RX_BUF_SIZE];
-    parserState state = {};
+int64_t txDoneUs() {
+    const int64_t now = clockNowUs();
+    return txEnd > now ? txEnd : now;
+}
 
-    while(true) {
-        size_t rxReady = 0;
-        ESP_ERROR_CHECK(uart_get_buffered_data_len(UART_NUM, &rxReady));
-        if(rxReady == 0) {
-            // Always wait for at least one byte, even if there is none available.
-            rxReady = 1;
-        }
+static int64_t ticksToUs(TickType_t ticks) {
+    return (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
 
-        const int rxBytes = uart_read_bytes(UART_NUM, data, rxReady, timeout > 0 ? timeout : 1000 / portTICK_PERIOD_MS);
-        if(timeout > 0 && rxBytes == 0) {
-            return MSG_TIMEOUT;
-        }
+/**
+ * Ticks to wait for at least the given time.
+ */
+TickType_t usToTicks(int64_t us) {
+    // Round up, so we don't wake up just before the time.
+    const int64_t tickUs = portTICK_PERIOD_MS * 1000;
+    return (TickType_t)((us + tickUs - 1) / tickUs);
+}
 
-        for(size_t bufferPos = 0; bufferPos < rxBytes; bufferPos++) {
-            readResult result = handleFraming(data[bufferPos], &state);
-            if(result != MSG_CONTINUE) {
-                if(result == MSG_OK) {
-                    message->target = state.target;
-                    message->source = state.source;
-                    message->type = state.type;
-                    if(state.size >= 5) {
-                        message->command = state.data[3];
-                        memcpy(message->payload, state.data + 4, state.size - 5);
-                        message->payloadSize = state.size - 5;
-                    }
-                }
-                return result;
-            }
-        }
-    }
+static rttClass exchangeClass(const busTransaction *transaction) {
+    return transaction->request.type == MSG_PING_REQ ? RTT_PING : RTT_COMMAND;
 }
 
-readResult readMessage(messageType *message) { return readMessage(message, 0); }
+static void sendRequest(busTransaction *transaction) {
+    writeMessage(transaction->request);
+    transaction->sent++;
+    transaction->retryUs = rttTimeoutUs(transaction->request.target, exchangeClass(transaction));
+    // Longer requests take a while to send, the target can't respond before it has them.
+    transaction->lastSent = txDoneUs();
+    transaction->lastActivity = transaction->lastSent;
+}
+
+/**
+ * Send a request, the response is collected by exchangePoll(..) or exchangeAwait(..).
+ * The request is resent each time the bus has been quiet for longer than the target usually takes to respond,
+ * up to attempts times (if not 0). Whatever happens, we give up after deadlineUs, or after CONFIG_ION_EXCHANGE_DEADLINE_MS if that is 0.
+ * Both count from when the request is done sending, the call itself returns once it is queued.
+ */
+void exchangeStart(busTransaction *transaction, const messageType& request, uint32_t attempts, int64_t deadlineUs) {
+    *transaction = {};
+    transaction->request = request;
+    transaction->attempts = attempts;
+    transaction->result = MSG_CONTINUE;
+    transaction->started = clockNowUs();
+    sendRequest(transaction);
+    transaction->deadline = transaction->lastSent + (deadlineUs > 0 ? deadlineUs : EXCHANGE_DEADLINE_US);
+}
+
+/**
+ * Handle what arrived for a transaction, waiting at most the given time (0 to not wait) for something to arrive.
+ * Requests addressed to us are passed to the request handler. Only a response to our request completes the transaction,
+ * see isResponseTo(..), other responses are counted as stale and dropped.
+ * Returns MSG_CONTINUE while still waiting, or the final result: MSG_OK, or MSG_NO_REPLY when out of attempts or time.
+ */
+readResult exchangePoll(busTransaction *transaction, TickType_t wait) {
+    if(transaction->result != MSG_CONTINUE) {
+        return transaction->result;
+    }
 
-void writeMessage(uint8_t *message, uint8_t messageLen) {
+    const int64_t now = clockNowUs();
+    int64_t until = transaction->deadline;
+    if(transaction->lastActivity + transaction->retryUs < until) {
+        until = transaction->lastActivity + transaction->retryUs;
+    }
+    if(now + ticksToUs(wait) < until) {
+        until = now + ticksToUs(wait);
+    }
 
-    // First create the full message, unescaped, includig crc.
-    uint8_t data[20];
-    data[0] = 0x10;
-    memcpy(data + 1, message, messageLen);
-    data[messageLen + 1] = crc8_bow(data, messageLen + 1);
+    rxEvent event;
+    if(receiveEvent(&event, until > now ? usToTicks(until - now) : 0)) {
+        if(event.time > transaction->lastActivity) {
+            transaction->lastActivity = event.time;
+        }
+        const frameView& message = event.message;
+        if(event.result == MSG_OK && message.target == MSG_BMS) {
+            if(isResponseTo(transaction->request, message)) {
+                if(transaction->sent == 1 && event.time > transaction->lastSent) {
+                    // After a resend we can't tell which request this answers, so only measure the first (Karn's algorithm).
+                    rttSample(transaction->request.target, exchangeClass(transaction), event.time - transaction->lastSent);
+                }
+                statsLatency(transaction->request.target, transaction->request.command, event.time - transaction->started);
+                transaction->response = message;
+                transaction->result = MSG_OK;
+                return MSG_OK;
+            }
+            if(message.type == MSG_CMD_RESP || message.type == MSG_PING_RESP) {
+                // Someone else's answer, or a late one to a request that was given up on. Keep waiting for ours.
+                statsAdd(STAT_STALE_REPLIES);
+            }
+            if((message.type == MSG_CMD_REQ || message.type == MSG_PING_REQ) && onRequest != NULL) {
+                onRequest(message, onRequestContext);
+            }
+        }
+    }
 
-    // Now create an escaped copy
-    uint8_t escaped[20 * 2];
-    uint8_t outPos = 0;
-    escaped[outPos++] = 0x10;
-    for(uint8_t inPos = 1; inPos < messageLen + 2; inPos++) {
-        escaped[outPos++] = data[inPos];
-        if(data[inPos] == 0x10) {
-            escaped[outPos++] = 0x10;
+    const int64_t after = clockNowUs();
+    if(after >= transaction->deadline) {
+        // Checked first: a caller that only waits briefly (e.g. for a node that may still be starting) says nothing about the node's speed.
+        ESP_LOGE(TAG, "No reply to command %02x in time", transaction->request.command);
+        transaction->result = MSG_NO_REPLY;
+        statsAdd(STAT_TIMEOUTS);
+    } else if(after >= transaction->lastActivity + transaction->retryUs) {
+        rttTimeout(transaction->request.target, exchangeClass(transaction));
+        if(transaction->attempts > 0 && transaction->sent >= transaction->attempts) {
+            ESP_LOGE(TAG, "Out of attempts sending command %02x", transaction->request.command);
+            transaction->result = MSG_NO_REPLY;
+            statsAdd(STAT_TIMEOUTS);
+        } else {
+            // Retry by sending the message again
+            sendRequest(transaction);
+            statsAdd(STAT_RETRIES);
         }
     }
-    uart_write_bytes(UART_NUM, escaped, outPos);
+    return transaction->result;
 }
 
-void writeMessage(const messageType& message) {
-    uint8_t data[18] = {};
-    size_t length = 1;
-    data[0] = nibbles(message.target, message.type);
-    if(message.type == MSG_PING_REQ || message.type == MSG_PING_RESP) {
-        data[1] = nibbles(message.source, 0);
-        length = 2;
-    } else if(message.type == MSG_CMD_REQ || message.type == MSG_CMD_RESP) {
-        data[1] = nibbles(message.source, message.payloadSize);
-        data[2] = message.command;
-        memcpy(data + 3, message.payload, message.payloadSize);
-        length = 3 + message.payloadSize;
+/**
+ * Wait until the transaction is done, which is at the latest its deadline.
+ */
+readResult exchangeAwait(busTransaction *transaction) {
+    readResult result;
+    while((result = exchangePoll(transaction, portMAX_DELAY)) == MSG_CONTINUE) {
     }
-    writeMessage(data, length);
+    return result;
 }
 
 /**
- * Send request message, and wait for (any) response message addressed to us.
- * If timeout is not set (0), will keep reading messages on the bus until we get a response message addressed to us.
- * If timeout is set and attempts is 0, will keep reading messages on the bus until we get a response message addressed to us,
- * and will re-send the request each time the bus has been quiet for the given timeout time.
- * If attempts is > 0, will do the same, but will stop and return MSG_NO_REPLY on the 'attempts'th timeout.
+ * Send request message, and wait for the response to it, see isResponseTo(..).
+ * Will re-send the request each time the bus has been quiet for longer than the target normally takes to respond, see rtt.h.
+ * If attempts is > 0, will stop and return MSG_NO_REPLY on the 'attempts'th timeout.
+ * In any case gives up after CONFIG_ION_EXCHANGE_DEADLINE_MS.
+ * Requests addressed to us that arrive in the meantime are handled, see setRequestHandler(..).
  *
  * Returns:
  * MSG_OK if we received a response.
- * MSG_NO_REPLY (only for attempts > 0) if after the given attempts, no valid response was received.
+ * MSG_NO_REPLY if no valid response was received in time.
  */
-readResult exchange(const messageType& outMessage, messageType *inMessage, const TickType_t timeout, const uint32_t attempts) {
-    writeMessage(outMessage);
-    uint32_t count = 1;
-    readResult result;
-    while(true) {
-        result = readMessage(inMessage, timeout);
-        if(result == MSG_TIMEOUT) {
-            if(attempts > 0 && count >= attempts) {
-                ESP_LOGE(TAG, "Out of attempts sending command %02x", outMessage.command);
-                return MSG_NO_REPLY;
-            }
-            // Retry by sending the message again
-            writeMessage(outMessage);
-            count++;
-        } else if(result == MSG_OK && inMessage->target == 0x02) {
-            // We got our response
-            break;
-        }
-    }
-
-    if(inMessage->command != outMessage.command) {
-        ESP_LOGE(TAG, "Wrong reply cmd, expected %02x, got %02x", outMessage.command, inMessage->command);
+readResult exchange(const messageType& outMessage, frameView *inMessage, const uint32_t attempts) {
+    busTransaction transaction;
+    exchangeStart(&transaction, outMessage, attempts, 0);
+    const readResult result = exchangeAwait(&transaction);
+    if(result == MSG_OK) {
+        *inMessage = transaction.response;
     }
-
     return result;
 }
 
-readResult exchange(const messageType& outMessage, messageType *inMessage, const TickType_t timeout) {
-    return exchange(outMessage, inMessage, timeout, 0); 
-}
-
-readResult exchange(const messageType& outMessage, messageType *inMessage) { 
+readResult exchange(const messageType& outMessage, frameView *inMessage) { 
     return exchange(outMessage, inMessage, 0); 
 }
 
 void exchange(const messageType& outMessage) {
-    messageType response = {};
-    readResult result = exchange(outMessage, &response);
+    frameView response = {};
+    exchange(outMessage, &response);
 }
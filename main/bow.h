@@ -2,53 +2,58 @@
 
 #include <sys/unistd.h>
 #include "freertos/FreeRTOS.h"
+#include "message.h"
+#include "parser.h"
 
-#define MSG_HANDOFF 0x0
-#define MSG_CMD_REQ 0x1
-#define MSG_CMD_RESP 0x2
-#define MSG_PING_REQ 0x4
-#define MSG_PING_RESP 0x3
-
-#define MSG_MOTOR 0x0
-#define MSG_BMS 0x2
-#define MSG_DISPLAY 0xC
-
-struct messageType {
-    // The target of the message
-    uint8_t target;
-    // The source of the message, 0x00 if not used (check type)
-    uint8_t source;
-    // The type of the message
-    uint8_t type;
-    // The command byte of the message, 0x00 if not used (check type)
-    uint8_t command;
-
-    // The payload of the message, and it's length.
-    // Payload length is indicated by one nibble, so max value 0xF (15).
-    uint8_t payload[15];
-    size_t payloadSize;
+struct rxEvent {
+    // MSG_OK, MSG_WAKEUP or MSG_CRC_ERROR.
+    readResult result;
+    // When it was received, in microseconds since boot.
+    int64_t time;
+    // The message, only for MSG_OK. Valid until the next readEvent(..), pollEvent(..) or exchangePoll(..).
+    frameView message;
 };
 
-enum readResult {
-    // Time-out waiting for reply on each attempt.
-    MSG_NO_REPLY,
-    // Reading timed out before getting a full message.
-    MSG_TIMEOUT,
-    // We got a '0x00' byte instead of a message.
-    MSG_WAKEUP,
-    // A message was read, but the CRC is invalid.
-    MSG_CRC_ERROR,
-    // For internal use, no error but message is not yet complete.
-    MSG_CONTINUE,
-    // Message received.
-    MSG_OK
+/**
+ * A request we sent, and the response we are waiting for, see exchangeStart(..).
+ */
+struct busTransaction {
+    messageType request;
+    // Resend the request when the bus was quiet this long, in microseconds, see rttTimeoutUs(..).
+    int64_t retryUs;
+    // Send the request at most this many times, 0 for no limit other than the deadline.
+    uint32_t attempts;
+    // Times the request was sent so far.
+    uint32_t sent;
+    // When the request was first sent, in microseconds since boot.
+    int64_t started;
+    // Give up at this time, in microseconds since boot.
+    int64_t deadline;
+    // When the last request was done sending, for measuring the response time.
+    int64_t lastSent;
+    // Last time we sent or received anything, for resending.
+    int64_t lastActivity;
+    // MSG_CONTINUE while waiting, then MSG_OK or MSG_NO_REPLY.
+    readResult result;
+    // The response for MSG_OK, valid until the next read.
+    frameView response;
 };
 
+// Called for requests addressed to us that arrive while we wait for a response.
+typedef void (*requestHandler)(const frameView& message, void *context);
+
 void initUart();
-readResult readMessage(messageType *message, TickType_t timeout);
-readResult readMessage(messageType *message);
-void writeMessage(const messageType& message);
-readResult exchange(const messageType& outMessage, messageType *inMessage, const TickType_t timeout, const uint32_t attempts);
-readResult exchange(const messageType& outMessage, messageType *inMessage, const TickType_t timeout);
-readResult exchange(const messageType& outMessage, messageType *inMessage);
+TickType_t usToTicks(int64_t us);
+int64_t txDoneUs();
+void setRequestHandler(requestHandler handler, void *context);
+readResult readEvent(rxEvent *event, TickType_t timeout);
+readResult pollEvent(rxEvent *event);
+size_t dropEvents();
+readResult readMessage(frameView *message, TickType_t timeout);
+readResult readMessage(frameView *message);
+void exchangeStart(busTransaction *transaction, const messageType& request, uint32_t attempts, int64_t deadlineUs);
+readResult exchangePoll(busTransaction *transaction, TickType_t wait);
+readResult exchangeAwait(busTransaction *transaction);
+readResult exchange(const messageType& outMessage, frameView *inMessage, const uint32_t attempts);
+readResult exchange(const messageType& outMessage, frameView *inMessage);
 void exchange(const messageType& outMessage);
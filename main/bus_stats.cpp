@@ -0,0 +1,108 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "bus_stats.h"
+
+static const char *TAG = "bus_stats";
+
+static const char *counterNames[STAT_COUNTERS] = {
+    "crc errors", "incomplete", "wakeups", "uart overflows", "rx stalls", "timeouts", "retries", "handoff timeouts", "latency untracked", "stale replies",
+};
+
+static busStats stats;
+
+void statsRxFrame(const frameView& frame) {
+    if(frame.type < STATS_TYPES) {
+        stats.rxFrames[frame.source & 0x0f][frame.type]++;
+    }
+}
+
+void statsTxFrame(uint8_t target, uint8_t type) {
+    if(type < STATS_TYPES) {
+        stats.txFrames[target & 0x0f][type]++;
+    }
+}
+
+void statsAdd(busCounter counter, uint32_t amount) {
+    stats.counters[counter] += amount;
+}
+
+static size_t bucket(int64_t us) {
+    size_t index = 0;
+    int64_t limit = STATS_BUCKET_FIRST_US;
+    while(index < STATS_BUCKETS - 1 && us >= limit) {
+        index++;
+        limit *= 2;
+    }
+    return index;
+}
+
+void statsLatency(uint8_t target, uint8_t command, int64_t us) {
+    latencyHistogram *histogram = NULL;
+    for(latencyHistogram& slot : stats.latency) {
+        if(!slot.used) {
+            slot.target = target;
+            slot.command = command;
+            slot.used = true;
+        }
+        if(slot.target == target && slot.command == command) {
+            histogram = &slot;
+            break;
+        }
+    }
+    if(histogram == NULL) {
+        statsAdd(STAT_LATENCY_UNTRACKED);
+        return;
+    }
+
+    histogram->buckets[bucket(us)]++;
+    histogram->totalUs += us;
+    if(us > histogram->maxUs) {
+        histogram->maxUs = us;
+    }
+}
+
+void statsSnapshot(busStats *snapshot) {
+    memcpy(snapshot, &stats, sizeof(stats));
+}
+
+void statsLog() {
+    static busStats snapshot;
+    statsSnapshot(&snapshot);
+
+    for(int node = 0; node < STATS_NODES; node++) {
+        uint32_t total = 0;
+        for(int type = 0; type < STATS_TYPES; type++) {
+            total += snapshot.rxFrames[node][type] + snapshot.txFrames[node][type];
+        }
+        if(total == 0) {
+            continue;
+        }
+        // Per type: handoff, cmd req, cmd resp, ping resp, ping req.
+        const uint32_t *rx = snapshot.rxFrames[node];
+        const uint32_t *tx = snapshot.txFrames[node];
+        ESP_LOGI(TAG, "Node %x rx %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 ", tx %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32,
+                 node, rx[0], rx[1], rx[2], rx[3], rx[4], tx[0], tx[1], tx[2], tx[3], tx[4]);
+    }
+
+    for(int counter = 0; counter < STAT_COUNTERS; counter++) {
+        if(snapshot.counters[counter] > 0) {
+            ESP_LOGI(TAG, "%s: %" PRIu32, counterNames[counter], snapshot.counters[counter]);
+        }
+    }
+
+    for(const latencyHistogram& histogram : snapshot.latency) {
+        if(!histogram.used) {
+            continue;
+        }
+        const uint32_t *b = histogram.buckets;
+        uint32_t count = 0;
+        for(int index = 0; index < STATS_BUCKETS; index++) {
+            count += b[index];
+        }
+        ESP_LOGI(TAG, "Node %x cmd %02x: %" PRIu32 " responses, mean %" PRIu32 "us, max %" PRIu32 "us, <5/10/20/40/80/160/320ms/more: %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32
+                 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32,
+                 histogram.target, histogram.command, count, count > 0 ? (uint32_t)(histogram.totalUs / count) : 0, histogram.maxUs,
+                 b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7]);
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "message.h"
+#include "parser.h"
+
+/**
+ * Bus statistics, cheap enough to always keep.
+ * Each counter is only updated by one task (the receive task for what we receive, the main task for the rest),
+ * so they are plain increments without locks. Readers take a snapshot, each counter in it is consistent by itself.
+ */
+
+// Nodes are addressed by a nibble, message types 0-4 are known.
+#define STATS_NODES 16
+#define STATS_TYPES 5
+
+// Latency buckets: < 5ms, < 10ms, < 20ms, ... < 320ms, and the rest.
+#define STATS_BUCKETS 8
+#define STATS_BUCKET_FIRST_US 5000
+
+// Commands we keep a latency histogram for, the first ones we see.
+#define STATS_COMMANDS 16
+
+enum busCounter {
+    // Frames with a bad CRC.
+    STAT_CRC_ERRORS,
+    // Frames cut off by the start of the next one.
+    STAT_INCOMPLETE,
+    // Single 0x00 wakeup bytes.
+    STAT_WAKEUPS,
+    // UART FIFO or buffer overflows, all buffered input is lost.
+    STAT_UART_OVERFLOWS,
+    // Times the receive task had to wait because the application did not keep up.
+    STAT_RX_STALLS,
+    // Exchanges that got no reply.
+    STAT_TIMEOUTS,
+    // Requests that were sent again.
+    STAT_RETRIES,
+    // Handoffs where the bus went quiet before control came back.
+    STAT_HANDOFF_TIMEOUTS,
+    // Responses for commands without a histogram, all slots were taken.
+    STAT_LATENCY_UNTRACKED,
+    // Responses to us that answer no request we are waiting for, e.g. late answers to requests we gave up on.
+    STAT_STALE_REPLIES,
+    STAT_COUNTERS
+};
+
+struct latencyHistogram {
+    // Node and command, only valid when used.
+    uint8_t target;
+    uint8_t command;
+    bool used;
+    uint32_t buckets[STATS_BUCKETS];
+    // Sum of all latencies, for the mean.
+    uint64_t totalUs;
+    uint32_t maxUs;
+};
+
+struct busStats {
+    // Received frames by source, sent frames by target.
+    uint32_t rxFrames[STATS_NODES][STATS_TYPES];
+    uint32_t txFrames[STATS_NODES][STATS_TYPES];
+    uint32_t counters[STAT_COUNTERS];
+    latencyHistogram latency[STATS_COMMANDS];
+};
+
+void statsRxFrame(const frameView& frame);
+void statsTxFrame(uint8_t target, uint8_t type);
+void statsAdd(busCounter counter, uint32_t amount = 1);
+
+/**
+ * Time from first sending a command until its response.
+ */
+void statsLatency(uint8_t target, uint8_t command, int64_t us);
+
+/**
+ * Copy the current statistics.
+ */
+void statsSnapshot(busStats *snapshot);
+
+/**
+ * Log the current statistics.
+ */
+void statsLog();
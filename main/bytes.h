@@ -1,6 +1,7 @@
 #pragma once
 
-#include <sys/unistd.h>
+#include <stdint.h>
+#include <stddef.h>
 
 uint16_t toUint16(const uint8_t *buffer, size_t offset);
 uint32_t toUint32(const uint8_t *buffer, size_t offset);
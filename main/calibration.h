@@ -1,5 +1,12 @@
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include "parser.h"
+#include "msg_handling.h"
 
-bool handleCalibrationMessage(const messageType& message);
\ No newline at end of file
+// Size of the calibration data, as in the PUT DATA request.
+#define CAL_SIZE 10
+
+// GET DATA and PUT DATA 38/3a handlers, see handleMessage().
+bool calibrationGetData(const frameView& message, ion_state * state);
+bool calibrationPutData(const frameView& message, ion_state * state);
@@ -0,0 +1,6 @@
+#include "esp_timer.h"
+#include "clock.h"
+
+int64_t clockNowUs() {
+    return esp_timer_get_time();
+}
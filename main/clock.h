@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Microseconds since boot (or since start, for native builds).
+ * Timing logic reads time from here only, so it can run on virtual time on the host, see host/clock_host.h.
+ * Waiting is still done with FreeRTOS, converted with usToTicks(..) at the call.
+ */
+int64_t clockNowUs();
@@ -25,6 +25,66 @@ messageType message(uint8_t target, uint8_t type) {
     return message(target, type, 0x00);
 }
 
+const char *cmdName(uint8_t command) {
+    switch(command) {
+        case CMD_GET_DATA: return "GET_DATA";
+        case CMD_PUT_DATA: return "PUT_DATA";
+        case CMD_BAT_STATUS_MOTOR_OFF: return "BAT_STATUS_MOTOR_OFF";
+        case CMD_BAT_STATUS_ASSIST: return "BAT_STATUS_ASSIST";
+        case CMD_BAT_WAKEUP: return "BAT_WAKEUP";
+        case CMD_BAT_CALIBRATE: return "BAT_CALIBRATE";
+        case CMD_BAT_SET_LIGHT: return "BAT_SET_LIGHT";
+        case CMD_BAT_SET_ASSIST_LEVEL: return "BAT_SET_ASSIST_LEVEL";
+        case CMD_GET_SERIAL: return "GET_SERIAL";
+        case CMD_BUTTON_POLL: return "BUTTON_POLL";
+        case CMD_MOTOR_ON: return "MOTOR_ON";
+        case CMD_MOTOR_OFF: return "MOTOR_OFF";
+        case CMD_ASSIST_ON: return "ASSIST_ON";
+        case CMD_ASSIST_OFF: return "ASSIST_OFF";
+        case CMD_SET_ASSIST_LEVEL: return "SET_ASSIST_LEVEL";
+        case CMD_CALIBRATE: return "CALIBRATE";
+        default: return NULL;
+    }
+}
+
+const char *nodeName(uint8_t address) {
+    switch(address) {
+        case MSG_MOTOR: return "MOTOR";
+        case MSG_BMS: return "BMS";
+        case MSG_DISPLAY: return "DISPLAY";
+        default: return NULL;
+    }
+}
+
+// A prebuilt frame for each target.
+struct targetFrames {
+    constFrame frames[16];
+};
+
+template <typename Build> static constexpr targetFrames makeTargetFrames(Build build) {
+    targetFrames result = {};
+    for(uint8_t target = 0; target < 16; target++) {
+        result.frames[target] = makeConstFrame(build(target));
+    }
+    return result;
+}
+
+static constexpr targetFrames handoffFrames = makeTargetFrames([](uint8_t target) {
+    return frameMessage(target, MSG_HANDOFF, 0x00, 0x00);
+});
+
+static constexpr targetFrames pingRespFrames = makeTargetFrames([](uint8_t target) {
+    return frameMessage(target, MSG_PING_RESP, MSG_BMS, 0x00);
+});
+
+const constFrame& handoffFrame(uint8_t target) {
+    return handoffFrames.frames[target & 0x0f];
+}
+
+const constFrame& pingRespFrame(uint8_t target) {
+    return pingRespFrames.frames[target & 0x0f];
+}
+
 messageType handoffMsg(uint8_t target) {
     return message(target, MSG_HANDOFF);
 }
@@ -52,3 +112,13 @@ messageType cmdReq(uint8_t target, uint8_t source, uint8_t command, uint8_t *pay
 messageType cmdResp(uint8_t target, uint8_t source, uint8_t command, uint8_t *payload, size_t payloadSize) {
     return message(target, MSG_CMD_RESP, source, command, payload, payloadSize);
 }
+
+bool isResponseTo(const messageType& request, const frameView& message) {
+    if(message.target != request.source || message.source != request.target) {
+        return false;
+    }
+    if(request.type == MSG_PING_REQ) {
+        return message.type == MSG_PING_RESP;
+    }
+    return request.type == MSG_CMD_REQ && message.type == MSG_CMD_RESP && message.command == request.command;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
-#include "bow.h"
+#include "message.h"
+#include "parser.h"
 
 // Generic commands
 #define CMD_GET_DATA 0x08
@@ -26,6 +27,22 @@
 #define CMD_SET_ASSIST_LEVEL 0x34
 #define CMD_CALIBRATE 0x35
 
+/**
+ * Name of a command above, for logs and tools. NULL for commands we have no name for.
+ */
+const char *cmdName(uint8_t command);
+
+/**
+ * Name of a bus address, NULL for addresses we have no name for.
+ */
+const char *nodeName(uint8_t address);
+
+/**
+ * Prebuilt handoff and ping response (from us) frames, for the fastest possible reply.
+ */
+const constFrame& handoffFrame(uint8_t target);
+const constFrame& pingRespFrame(uint8_t target);
+
 messageType handoffMsg(uint8_t target);
 messageType pingReq(uint8_t target, uint8_t source);
 messageType pingResp(uint8_t target, uint8_t source);
@@ -33,3 +50,9 @@ messageType cmdReq(uint8_t target, uint8_t source, uint8_t command);
 messageType cmdResp(uint8_t target, uint8_t source, uint8_t command);
 messageType cmdReq(uint8_t target, uint8_t source, uint8_t command, uint8_t *payload, size_t payloadSize);
 messageType cmdResp(uint8_t target, uint8_t source, uint8_t command, uint8_t *payload, size_t payloadSize);
+
+/**
+ * Whether a received frame answers our request: a response to us, from the node we asked, to the same command.
+ * Ping responses have no command, those only need to come from that node.
+ */
+bool isResponseTo(const messageType& request, const frameView& message);
@@ -29,27 +29,90 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */ 
 
+#include "sdkconfig.h"
 #include "crc8.h"
 
-uint8_t crc8_bow( uint8_t *data_in, uint8_t len){
-	uint8_t crc;
-	uint8_t i,j,f;
-	uint8_t data;
+/*
+	The bit by bit loop below shifts right, and when a 1 drops out it xors POLY before the shift
+	and sets the top bit after it. That's the same as xoring the reflected polynomial 0xA1 after the shift,
+	which the tables below are generated from:
+	table256[i] is 8 such shifts of i, table16[i] is 4 shifts of i.
+ */
+
+static const uint8_t table16[16] = {
+	0x00, 0xcd, 0xd9, 0x14, 0xf1, 0x3c, 0x28, 0xe5, 0xa1, 0x6c, 0x78, 0xb5, 0x50, 0x9d, 0x89, 0x44
+};
+
+static const uint8_t table256[256] = {
+	0x00, 0x91, 0x61, 0xf0, 0xc2, 0x53, 0xa3, 0x32, 0xc7, 0x56, 0xa6, 0x37, 0x05, 0x94, 0x64, 0xf5,
+	0xcd, 0x5c, 0xac, 0x3d, 0x0f, 0x9e, 0x6e, 0xff, 0x0a, 0x9b, 0x6b, 0xfa, 0xc8, 0x59, 0xa9, 0x38,
+	0xd9, 0x48, 0xb8, 0x29, 0x1b, 0x8a, 0x7a, 0xeb, 0x1e, 0x8f, 0x7f, 0xee, 0xdc, 0x4d, 0xbd, 0x2c,
+	0x14, 0x85, 0x75, 0xe4, 0xd6, 0x47, 0xb7, 0x26, 0xd3, 0x42, 0xb2, 0x23, 0x11, 0x80, 0x70, 0xe1,
+	0xf1, 0x60, 0x90, 0x01, 0x33, 0xa2, 0x52, 0xc3, 0x36, 0xa7, 0x57, 0xc6, 0xf4, 0x65, 0x95, 0x04,
+	0x3c, 0xad, 0x5d, 0xcc, 0xfe, 0x6f, 0x9f, 0x0e, 0xfb, 0x6a, 0x9a, 0x0b, 0x39, 0xa8, 0x58, 0xc9,
+	0x28, 0xb9, 0x49, 0xd8, 0xea, 0x7b, 0x8b, 0x1a, 0xef, 0x7e, 0x8e, 0x1f, 0x2d, 0xbc, 0x4c, 0xdd,
+	0xe5, 0x74, 0x84, 0x15, 0x27, 0xb6, 0x46, 0xd7, 0x22, 0xb3, 0x43, 0xd2, 0xe0, 0x71, 0x81, 0x10,
+	0xa1, 0x30, 0xc0, 0x51, 0x63, 0xf2, 0x02, 0x93, 0x66, 0xf7, 0x07, 0x96, 0xa4, 0x35, 0xc5, 0x54,
+	0x6c, 0xfd, 0x0d, 0x9c, 0xae, 0x3f, 0xcf, 0x5e, 0xab, 0x3a, 0xca, 0x5b, 0x69, 0xf8, 0x08, 0x99,
+	0x78, 0xe9, 0x19, 0x88, 0xba, 0x2b, 0xdb, 0x4a, 0xbf, 0x2e, 0xde, 0x4f, 0x7d, 0xec, 0x1c, 0x8d,
+	0xb5, 0x24, 0xd4, 0x45, 0x77, 0xe6, 0x16, 0x87, 0x72, 0xe3, 0x13, 0x82, 0xb0, 0x21, 0xd1, 0x40,
+	0x50, 0xc1, 0x31, 0xa0, 0x92, 0x03, 0xf3, 0x62, 0x97, 0x06, 0xf6, 0x67, 0x55, 0xc4, 0x34, 0xa5,
+	0x9d, 0x0c, 0xfc, 0x6d, 0x5f, 0xce, 0x3e, 0xaf, 0x5a, 0xcb, 0x3b, 0xaa, 0x98, 0x09, 0xf9, 0x68,
+	0x89, 0x18, 0xe8, 0x79, 0x4b, 0xda, 0x2a, 0xbb, 0x4e, 0xdf, 0x2f, 0xbe, 0x8c, 0x1d, 0xed, 0x7c,
+	0x44, 0xd5, 0x25, 0xb4, 0x86, 0x17, 0xe7, 0x76, 0x83, 0x12, 0xe2, 0x73, 0x41, 0xd0, 0x20, 0xb1
+};
+
+uint8_t crc8_bow_update_bitwise( uint8_t crc, const uint8_t *data_in, uint8_t len){
+	uint8_t j;
+
+	for (j = 0; j != len; j++){
+		crc = crc8_bow_byte_bitwise(crc, data_in[j]);
+	}
+	return crc;
+}
+
+uint8_t crc8_bow_update_table16( uint8_t crc, const uint8_t *data_in, uint8_t len){
+	uint8_t j;
+
+	for (j = 0; j != len; j++){
+		crc ^= data_in[j];
+		crc = (crc >> 4) ^ table16[crc & 0x0f];
+		crc = (crc >> 4) ^ table16[crc & 0x0f];
+	}
+	return crc;
+}
+
+uint8_t crc8_bow_update_table256( uint8_t crc, const uint8_t *data_in, uint8_t len){
+	uint8_t j;
 
-	crc = INIT;
 	for (j = 0; j != len; j++){
-		data = data_in[j];
-		for(i = 8; i; i--) {
-			f = ((crc ^ data) & 0x01);
-			if (f == 0x01){
-				crc = crc ^ POLY;
-			}
-			crc = (crc >> 1) & 0x7F;
-			if (f == 0x01){
-				crc = crc | 0x80;
-			}
-			data = data >> 1;
-		}
+		crc = table256[crc ^ data_in[j]];
 	}
 	return crc;
 }
+
+uint8_t crc8_bow_update( uint8_t crc, const uint8_t *data_in, uint8_t len){
+#if CONFIG_ION_CRC8_TABLE_256
+	return crc8_bow_update_table256(crc, data_in, len);
+#elif CONFIG_ION_CRC8_TABLE_16
+	return crc8_bow_update_table16(crc, data_in, len);
+#else
+	return crc8_bow_update_bitwise(crc, data_in, len);
+#endif
+}
+
+uint8_t crc8_bow_byte( uint8_t crc, uint8_t data){
+#if CONFIG_ION_CRC8_TABLE_256
+	return table256[crc ^ data];
+#elif CONFIG_ION_CRC8_TABLE_16
+	crc ^= data;
+	crc = (crc >> 4) ^ table16[crc & 0x0f];
+	return (crc >> 4) ^ table16[crc & 0x0f];
+#else
+	return crc8_bow_byte_bitwise(crc, data);
+#endif
+}
+
+uint8_t crc8_bow( const uint8_t *data_in, uint8_t len){
+	return crc8_bow_update(INIT, data_in, len);
+}
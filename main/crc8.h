@@ -38,6 +38,37 @@
 #define INIT	0x07
 #define POLY	0x42
 
-uint8_t crc8_bow( uint8_t *data_in, uint8_t len);
+// Continue a CRC over more data, using the implementation selected in Kconfig.
+uint8_t crc8_bow_update( uint8_t crc, const uint8_t *data_in, uint8_t len);
+
+// CRC of a full message, starting from INIT.
+uint8_t crc8_bow( const uint8_t *data_in, uint8_t len);
+
+// Continue a CRC by one byte, for encoding a frame in one pass, using the implementation selected in Kconfig.
+uint8_t crc8_bow_byte( uint8_t crc, uint8_t data);
+
+// Continue a CRC by one byte, bit by bit. Also works at compile time.
+constexpr uint8_t crc8_bow_byte_bitwise( uint8_t crc, uint8_t data){
+	for(uint8_t i = 8; i; i--) {
+		const uint8_t f = ((crc ^ data) & 0x01);
+		if (f == 0x01){
+			crc = crc ^ POLY;
+		}
+		crc = (crc >> 1) & 0x7F;
+		if (f == 0x01){
+			crc = crc | 0x80;
+		}
+		data = data >> 1;
+	}
+	return crc;
+}
+
+// The individual implementations, all give identical results.
+// Bit by bit, no table.
+uint8_t crc8_bow_update_bitwise( uint8_t crc, const uint8_t *data_in, uint8_t len);
+// Two lookups per byte in a 16 entry table (16 bytes).
+uint8_t crc8_bow_update_table16( uint8_t crc, const uint8_t *data_in, uint8_t len);
+// One lookup per byte in a 256 entry table (256 bytes).
+uint8_t crc8_bow_update_table256( uint8_t crc, const uint8_t *data_in, uint8_t len);
 
 #endif /* CRC8_H_ */
\ No newline at end of file
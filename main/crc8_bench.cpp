@@ -0,0 +1,53 @@
+#include "sdkconfig.h"
+#if CONFIG_ION_CRC8_BENCHMARK
+
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "crc8.h"
+
+#include "crc8_bench.h"
+
+static const char *TAG = "crc8_bench";
+
+// Longest message on the bus, 15 byte payload + 5.
+#define FRAME_SIZE 20
+#define ROUNDS 1000
+
+typedef uint8_t (*crcUpdateFunc)(uint8_t crc, const uint8_t *data_in, uint8_t len);
+
+struct crcImpl {
+    const char *name;
+    crcUpdateFunc update;
+};
+
+static const crcImpl impls[] = {
+    {"bitwise", crc8_bow_update_bitwise},
+    {"table16", crc8_bow_update_table16},
+    {"table256", crc8_bow_update_table256},
+};
+
+void crc8Benchmark() {
+    uint8_t frame[FRAME_SIZE];
+    uint8_t value = 0x5a;
+    for(size_t pos = 0; pos < sizeof(frame); pos++) {
+        // Some arbitrary, non repeating looking data.
+        value = value * 37 + 11;
+        frame[pos] = value;
+    }
+
+    for(const crcImpl& impl : impls) {
+        volatile uint8_t result = 0;
+        const uint32_t start = esp_cpu_get_cycle_count();
+        for(uint32_t round = 0; round < ROUNDS; round++) {
+            result = impl.update(INIT, frame, sizeof(frame));
+        }
+        const uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+        // Cycles per byte, times 100 for two decimals.
+        const uint32_t perByte100 = (uint32_t)(((uint64_t)cycles * 100) / (ROUNDS * sizeof(frame)));
+        ESP_LOGI(TAG, "%-8s %" PRIu32 ".%02" PRIu32 " cycles/byte, crc %02x", impl.name, perByte100 / 100, perByte100 % 100, result);
+    }
+}
+
+#endif
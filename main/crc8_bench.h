@@ -0,0 +1,11 @@
+#pragma once
+
+#include "sdkconfig.h"
+#if CONFIG_ION_CRC8_BENCHMARK
+
+/**
+ * Log how many cycles per byte each CRC8 implementation takes. That they give the same results is checked on the host, see host/bow_test.cpp.
+ */
+void crc8Benchmark();
+
+#endif
@@ -10,6 +10,13 @@ void setControlBits(const EventBits_t uxBitsToSet) {
     xEventGroupSetBits(controlEventGroup, uxBitsToSet);
 }
 
+void setControlBitsFromISR(const EventBits_t uxBitsToSet) {
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    if(xEventGroupSetBitsFromISR(controlEventGroup, uxBitsToSet, &higherPriorityTaskWoken) == pdPASS) {
+        portYIELD_FROM_ISR(higherPriorityTaskWoken);
+    }
+}
+
 void clearControlBits(const EventBits_t uxBitsToClear) {
     xEventGroupClearBits(controlEventGroup, uxBitsToClear);
 }
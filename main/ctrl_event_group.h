@@ -10,12 +10,17 @@ static const int BUTTON_LIGHT_LONG_PRESS_BIT = BIT3;
 static const int IGNORE_HELD_BIT = BIT4;
 static const int WAKEUP_BIT = BIT5;
 static const int CALIBRATE_BIT = BIT6;
-static const int MEASURE_BAT_BIT = BIT7;
+// Something was queued for readEvent(..).
+static const int BUS_RX_BIT = BIT7;
+// The charge pin changed.
+static const int CHARGE_PIN_BIT = BIT8;
 
 void initControlEventGroup();
 
 void setControlBits(const EventBits_t uxBitsToSet);
 
+void setControlBitsFromISR(const EventBits_t uxBitsToSet);
+
 void clearControlBits(const EventBits_t uxBitsToSet);
 
 EventBits_t waitControlBits(const EventBits_t uxBitsToWaitFor,
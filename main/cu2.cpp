@@ -1,30 +1,24 @@
 #include <sys/unistd.h>
 #include "freertos/FreeRTOS.h"
-#include "freertos/timers.h"
 #include "freertos/event_groups.h"
 #include "bow.h"
 #include "cmds.h"
 #include "ctrl_event_group.h"
+#include "scheduler.h"
 
 #include "cu2.h"
 
 // The amount of button updates (100ms) each for a long press
 #define LONG_PRESS_UPDATES 50
 
-static const int CHECK_BUTTON_BIT = BIT0;
+// The display expects a button check every 100ms.
+#define BUTTON_CHECK_MIN_MS 90
+#define BUTTON_CHECK_MAX_MS 110
 
-static TimerHandle_t buttonCheckTimer;
-
-static EventGroupHandle_t displayEventGroupHandle;
-
-static void buttonCheckTimerCallback(TimerHandle_t xTimer) {
-    xEventGroupSetBits(displayEventGroupHandle, CHECK_BUTTON_BIT);
-}
+static void buttonCheckJob(void *context) { buttonCheck(); }
 
 void initCu2() {
-    displayEventGroupHandle = xEventGroupCreate();
-
-    buttonCheckTimer = xTimerCreate("buttonCheckTimer", (100 / portTICK_PERIOD_MS), pdTRUE, (void *)0, buttonCheckTimerCallback);
+    schedulerAdd(JOB_BUTTON_CHECK, buttonCheckJob, 0, BUTTON_CHECK_MIN_MS, BUTTON_CHECK_MAX_MS);
 }
 
 void buttonCheck() {
@@ -44,8 +38,12 @@ void buttonCheck() {
     // Reply indicates if/which button is pressed.
     uint8_t payload[] = {count};
 
-    messageType response = {};
+    frameView response = {};
     readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_BUTTON_POLL, payload, sizeof(payload)), &response);
+    if(result != MSG_OK || response.payloadSize < 1) {
+        // Try again on the next check.
+        return;
+    }
 
     // The first is '00','01','02' or '03', depending on whether the top, bottom, or both buttons are presse
 
@@ -89,9 +87,9 @@ void buttonCheck() {
     count %= 0x10;
 }
 
-void startButtonCheck() { xTimerStart(buttonCheckTimer, 0); }
+void startButtonCheck() { schedulerStart(JOB_BUTTON_CHECK); }
 
-void stopButtonCheck() { xTimerStop(buttonCheckTimer, 0); }
+void stopButtonCheck() { schedulerStop(JOB_BUTTON_CHECK); }
 
 void ignorePress() {
     setControlBits(IGNORE_HELD_BIT);
@@ -108,19 +106,6 @@ uint32_t digits(uint32_t value, size_t digits, size_t atleast) {
     return result;
 }
 
-bool cu2HandleDisplayUpdate() {
-    EventBits_t bitsToCheck = CHECK_BUTTON_BIT;
-
-    EventBits_t bits = xEventGroupWaitBits(displayEventGroupHandle, bitsToCheck, false, false, 0);
-    if((bits & CHECK_BUTTON_BIT) != 0) {
-        xEventGroupClearBits(displayEventGroupHandle, CHECK_BUTTON_BIT);
-        buttonCheck();
-        return true;
-    }
-
-    return false;
-}
-
 void displayUpdateCu2(bool setDefault,
                    assist_level assistLevel,
                    blink_speed assistBlink,
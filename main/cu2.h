@@ -15,8 +15,6 @@ void stopButtonCheck();
 
 void ignorePress();
 
-bool cu2HandleDisplayUpdate();
-
 /**
  * Convert the given value to a value where each hexidecimal position shows a digit of the original value.
  * @param digits the maximum amount of digits to convert.
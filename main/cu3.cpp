@@ -2,8 +2,8 @@
 #if CONFIG_ION_CU3
 
 #include <sys/unistd.h>
-#include "esp_timer.h"
 #include "bytes.h"
+#include "clock.h"
 #include "bow.h"
 #include "cmds.h"
 #include "bat.h"
@@ -40,8 +40,8 @@ void displayUpdateCu3(display_type type, bool screen, bool light, bool battery2,
     FROM_UINT16(speed),
     FROM_UINT32(trip1),
     FROM_UINT32(trip2)};
-    messageType message = {};
-    readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, 0x28, payload, sizeof(payload)), &message, 225 / portTICK_PERIOD_MS );
+    frameView message = {};
+    exchange(cmdReq(MSG_DISPLAY, MSG_BMS, 0x28, payload, sizeof(payload)), &message);
 }
 
 /**
@@ -71,7 +71,7 @@ static uint16_t toCu3BatValue(uint8_t batPercentage) {
  * Get seconds since boot 
  */
 static int64_t getSecondsSinceBoot() {
-    return esp_timer_get_time() / (1000 * 1000);
+    return clockNowUs() / (1000 * 1000);
 }
 
 /**
@@ -81,65 +81,76 @@ static uint32_t getSecondsDisplay() {
     return (getSecondsSinceBoot() + seconds24h + offset) % seconds24h;
 }
 
-/** 
- * Handle the messages that seem to be sent by the CU3 only.
- */
-bool handleCu3Message(const messageType& message) {
-    if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x3b) {
-        // GET DATA 083b 08:3b(Distance to maintenance)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], 0x00, 0x01, 0xE2, 0x08};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x80) {
-        // GET DATA 0880 08:80(Total distance)
-        uint32_t total = getTotal();
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], FROM_UINT32(total)};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x8e) {
-        // GET DATA 088e 08:8e(Time)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], FROM_UINT32(getSecondsDisplay())};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x18) {
-        // GET DATA 1418 14:18(Battery level)
-        uint16_t batVal = toCu3BatValue(getBatPercentage());
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], FROM_UINT16(batVal)};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 4 && message.command == CMD_GET_DATA && message.payload[1] == 0x18 && message.payload[3] == 0x1a) {
-        // GET DATA 9418141a 14:18(Battery level) 14:1a(Max battery level)
-        uint16_t batVal = toCu3BatValue(getBatPercentage());
-        uint16_t batMax = cu3BatMaxValue();
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], FROM_UINT16(batVal), message.payload[2], message.payload[3], FROM_UINT16(batMax)};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x94) {
-        // GET DATA 2894 28:94(Unknown)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], 0x40, 0x0e, 0x14, 0x7b};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 3 && message.command == CMD_GET_DATA && message.payload[1] == 0x9a && message.payload[2] == 0x00) {
-        // GET DATA 449a00 44:9a[0](Max speed)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], 0x02, 0x00, 0x00, 0x00, 0xd0};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 3 && message.command == CMD_GET_DATA && message.payload[1] == 0x99 && message.payload[2] == 0x00) {
-        // GET DATA 489900 48:99[0](Trip time)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf6};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 6 && message.command == CMD_PUT_DATA && message.payload[1] == 0x8e) {
-        // PUT DATA 8e, (Time)
-        uint32_t newTime = toUint32(message.payload, 2);
-        uint32_t baseTime = (getSecondsSinceBoot() + seconds24h) % seconds24h;
-        offset = newTime - baseTime;
-
-        uint8_t payload[] = {0x00};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return true;
+constexpr constFrame cu3MaintenanceDistanceReply = makeConstFrame(frameMessage(MSG_DISPLAY, MSG_CMD_RESP, MSG_BMS, CMD_GET_DATA,
+    {0x00, DATA_TYPE_UINT | DATA_SIZE_4, DATA_MAINTENANCE_DISTANCE, 0x00, 0x01, 0xe2, 0x08}));
+
+// 2.22f
+constexpr constFrame cu3Reply94 = makeConstFrame(frameMessage(MSG_DISPLAY, MSG_CMD_RESP, MSG_BMS, CMD_GET_DATA,
+    {0x00, DATA_TYPE_FLOAT | DATA_SIZE_4, DATA_UNKNOWN_94, 0x40, 0x0e, 0x14, 0x7b}));
+
+bool cu3GetMaintenanceDistance(dataWriter *writer, const dataItem& request) {
+    // GET DATA 083b 08:3b(Distance to maintenance)
+    dataWriteUint(writer, request.id, 0x0001e208);
+    return true;
+}
+
+bool cu3GetTotalDistance(dataWriter *writer, const dataItem& request) {
+    // GET DATA 0880 08:80(Total distance)
+    dataWriteUint(writer, request.id, getTotal());
+    return true;
+}
+
+bool cu3GetTime(dataWriter *writer, const dataItem& request) {
+    // GET DATA 088e 08:8e(Time)
+    dataWriteUint(writer, request.id, getSecondsDisplay());
+    return true;
+}
+
+bool cu3GetBatteryLevel(dataWriter *writer, const dataItem& request) {
+    // GET DATA 1418 14:18(Battery level)
+    dataWriteInt(writer, request.id, toCu3BatValue(getBatPercentage()));
+    return true;
+}
+
+bool cu3GetBatteryLevelMax(dataWriter *writer, const dataItem& request) {
+    // GET DATA 141a 14:1a(Max battery level), always asked for together with the battery level: 9418141a
+    dataWriteInt(writer, request.id, cu3BatMaxValue());
+    return true;
+}
+
+bool cu3Get94(dataWriter *writer, const dataItem& request) {
+    // GET DATA 2894 28:94(Unknown)
+    dataWriteFloat(writer, request.id, 2.22f);
+    return true;
+}
+
+bool cu3GetMaxSpeed(dataWriter *writer, const dataItem& request) {
+    if(request.index != 0) {
+        return false;
     }
-    return false;
+
+    // GET DATA 449a00 44:9a[0](Max speed)
+    static const uint8_t elements[] = {FROM_UINT16(0x0000), FROM_UINT16(0x00d0)};
+    dataWriteArray(writer, request.id, elements, 2);
+    return true;
+}
+
+bool cu3GetTripTime(dataWriter *writer, const dataItem& request) {
+    if(request.index != 0) {
+        return false;
+    }
+
+    // GET DATA 489900 48:99[0](Trip time)
+    static const uint8_t elements[] = {FROM_UINT32(0x00000000), FROM_UINT32(0x000000f6)};
+    dataWriteArray(writer, request.id, elements, 2);
+    return true;
+}
+
+void cu3PutTime(const dataItem& item, ion_state * state) {
+    // PUT DATA 8e, (Time)
+    uint32_t newTime = dataUint(item);
+    uint32_t baseTime = (getSecondsSinceBoot() + seconds24h) % seconds24h;
+    offset = newTime - baseTime;
 }
 
 #endif
@@ -4,12 +4,26 @@
 #if CONFIG_ION_CU3
 
 #include "bow.h"
+#include "msg_handling.h"
 #include <sys/unistd.h>
 
 enum display_type { DSP_SCREEN = 0, DSP_BAT_CHARGE, DSP_BAT };
 
 void displayUpdateCu3(display_type type, bool screen, bool light, bool battery2, uint8_t assist, uint16_t speed, uint32_t trip1, uint32_t trip2);
 
-bool handleCu3Message(const messageType& message);
+// Data providers for the GET DATA and PUT DATA items that seem to be sent by the CU3 only, see handleMessage().
+bool cu3GetMaintenanceDistance(dataWriter *writer, const dataItem& request);
+bool cu3GetTotalDistance(dataWriter *writer, const dataItem& request);
+bool cu3GetTime(dataWriter *writer, const dataItem& request);
+bool cu3GetBatteryLevel(dataWriter *writer, const dataItem& request);
+bool cu3GetBatteryLevelMax(dataWriter *writer, const dataItem& request);
+bool cu3Get94(dataWriter *writer, const dataItem& request);
+bool cu3GetMaxSpeed(dataWriter *writer, const dataItem& request);
+bool cu3GetTripTime(dataWriter *writer, const dataItem& request);
+void cu3PutTime(const dataItem& item, ion_state * state);
+
+// Prebuilt responses for the values that never change.
+extern const constFrame cu3MaintenanceDistanceReply;
+extern const constFrame cu3Reply94;
 
 #endif
@@ -0,0 +1,209 @@
+#include <string.h>
+#include "data.h"
+
+static const dataIdInfo registry[] = {
+    {DATA_BAT_LEVEL, DATA_TYPE_INT | DATA_SIZE_2, "Battery level"},
+    {DATA_BAT_LEVEL_MAX, DATA_TYPE_INT | DATA_SIZE_2, "Max battery level"},
+    {DATA_UNKNOWN_2A, DATA_TYPE_UINT | DATA_SIZE_1, "Unknown 2a"},
+    {DATA_CALIBRATION_1, DATA_TYPE_INT | DATA_SIZE_2, "Calibration 1"},
+    {DATA_CALIBRATION_2, DATA_TYPE_FLOAT | DATA_SIZE_4, "Calibration 2"},
+    {DATA_MAINTENANCE_DISTANCE, DATA_TYPE_UINT | DATA_SIZE_4, "Distance to maintenance"},
+    {DATA_SERIALS, DATA_TYPE_ARRAY | DATA_SIZE_1, "Serials"},
+    {DATA_TOTAL_DISTANCE, DATA_TYPE_UINT | DATA_SIZE_4, "Total distance"},
+    {DATA_TIME, DATA_TYPE_UINT | DATA_SIZE_4, "Time"},
+    {DATA_UNKNOWN_94, DATA_TYPE_FLOAT | DATA_SIZE_4, "Unknown 94"},
+    {DATA_TRIP_TIME, DATA_TYPE_ARRAY | DATA_SIZE_4, "Trip time"},
+    {DATA_MAX_SPEED, DATA_TYPE_ARRAY | DATA_SIZE_2, "Max speed"},
+    {DATA_MOTOR_LIMIT, DATA_TYPE_INT | DATA_SIZE_2, "Motor limit"},
+    {DATA_BAT_VOLTAGE, DATA_TYPE_INT | DATA_SIZE_2, "Battery voltage"},
+    {DATA_SPEED, DATA_TYPE_INT | DATA_SIZE_2, "Speed"},
+    {DATA_DISTANCE, DATA_TYPE_UINT | DATA_SIZE_4, "Distance"},
+    {DATA_UNKNOWN_DF, DATA_TYPE_UINT | DATA_SIZE_1, "Unknown df"},
+};
+
+const dataIdInfo *dataLookup(uint8_t id) {
+    for(const dataIdInfo& info : registry) {
+        if(info.id == id) {
+            return &info;
+        }
+    }
+    return NULL;
+}
+
+void dataReaderInit(dataReader *reader, const uint8_t *data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->pos = 0;
+}
+
+/**
+ * Read the tag and ID, after the last item the reader size is cut down so there's nothing left.
+ */
+static bool readHeader(dataReader *reader, dataItem *item) {
+    if(reader->pos + 2 > reader->size) {
+        return false;
+    }
+    item->tag = reader->data[reader->pos];
+    item->id = reader->data[reader->pos + 1];
+    item->index = 0;
+    item->value = NULL;
+    item->count = 1;
+    reader->pos += 2;
+    return true;
+}
+
+bool dataReadRequest(dataReader *reader, dataItem *item) {
+    if(!readHeader(reader, item)) {
+        return false;
+    }
+    if(dataTagArray(item->tag)) {
+        if(reader->pos + 1 > reader->size) {
+            return false;
+        }
+        item->index = reader->data[reader->pos++];
+    }
+    if((item->tag & DATA_MORE) == 0) {
+        // Nothing after the last item.
+        reader->size = reader->pos;
+    }
+    return true;
+}
+
+bool dataReadValue(dataReader *reader, dataItem *item) {
+    if(!readHeader(reader, item)) {
+        return false;
+    }
+    if(dataTagArray(item->tag)) {
+        if(reader->pos + 1 > reader->size) {
+            return false;
+        }
+        item->count = reader->data[reader->pos++];
+    }
+    const size_t length = dataTagSize(item->tag) * item->count;
+    if(reader->pos + length > reader->size) {
+        return false;
+    }
+    item->value = reader->data + reader->pos;
+    reader->pos += length;
+    if((item->tag & DATA_MORE) == 0) {
+        reader->size = reader->pos;
+    }
+    return true;
+}
+
+uint32_t dataUint(const dataItem& item) {
+    uint32_t result = 0;
+    for(size_t pos = 0; pos < dataTagSize(item.tag); pos++) {
+        result = (result << 8) | item.value[pos];
+    }
+    return result;
+}
+
+int32_t dataInt(const dataItem& item) {
+    const size_t bits = dataTagSize(item.tag) * 8;
+    const uint32_t value = dataUint(item);
+    if(bits < 32 && (value & (1u << (bits - 1))) != 0) {
+        // Sign extend
+        return (int32_t)(value | (0xffffffffu << bits));
+    }
+    return (int32_t)value;
+}
+
+float dataFloat(const dataItem& item) {
+    const uint32_t bits = dataUint(item);
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void dataWriterInit(dataWriter *writer, uint8_t *buffer, size_t max) {
+    writer->buffer = buffer;
+    writer->max = max;
+    writer->size = 0;
+    writer->lastTag = -1;
+    writer->failed = false;
+}
+
+/**
+ * Start an item, with the tag from the registry, and flag the previous item as not the last.
+ * Returns the registry tag, or 0xff if the item does not fit or the ID is unknown.
+ */
+static uint8_t writeHeader(dataWriter *writer, uint8_t id, size_t length) {
+    const dataIdInfo *info = dataLookup(id);
+    if(writer->failed || info == NULL || writer->size + 2 + length > writer->max) {
+        writer->failed = true;
+        return 0xff;
+    }
+    if(writer->lastTag >= 0) {
+        writer->buffer[writer->lastTag] |= DATA_MORE;
+    }
+    writer->lastTag = writer->size;
+    writer->buffer[writer->size++] = info->tag;
+    writer->buffer[writer->size++] = id;
+    return info->tag;
+}
+
+void dataWriteRequest(dataWriter *writer, uint8_t id, uint8_t index) {
+    const dataIdInfo *info = dataLookup(id);
+    const bool array = info != NULL && dataTagArray(info->tag);
+    if(writeHeader(writer, id, array ? 1 : 0) != 0xff && array) {
+        writer->buffer[writer->size++] = index;
+    }
+}
+
+void dataWriteUint(dataWriter *writer, uint8_t id, uint32_t value) {
+    const dataIdInfo *info = dataLookup(id);
+    const size_t length = info != NULL ? dataTagSize(info->tag) : 0;
+    if(info != NULL && dataTagArray(info->tag)) {
+        writer->failed = true;
+        return;
+    }
+    if(writeHeader(writer, id, length) == 0xff) {
+        return;
+    }
+    for(size_t pos = 0; pos < length; pos++) {
+        writer->buffer[writer->size++] = (uint8_t)(value >> (8 * (length - 1 - pos)));
+    }
+}
+
+void dataWriteInt(dataWriter *writer, uint8_t id, int32_t value) {
+    dataWriteUint(writer, id, (uint32_t)value);
+}
+
+void dataWriteFloat(dataWriter *writer, uint8_t id, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    dataWriteUint(writer, id, bits);
+}
+
+void dataWriteArray(dataWriter *writer, uint8_t id, const uint8_t *elements, uint8_t count) {
+    const dataIdInfo *info = dataLookup(id);
+    if(info == NULL || !dataTagArray(info->tag)) {
+        writer->failed = true;
+        return;
+    }
+    const size_t length = dataTagSize(info->tag) * count;
+    if(writeHeader(writer, id, 1 + length) == 0xff) {
+        return;
+    }
+    writer->buffer[writer->size++] = count;
+    memcpy(writer->buffer + writer->size, elements, length);
+    writer->size += length;
+}
+
+void dataWriteArrayPut(dataWriter *writer, uint8_t id, uint8_t index, const uint8_t *elements, uint8_t count) {
+    const dataIdInfo *info = dataLookup(id);
+    if(info == NULL || !dataTagArray(info->tag)) {
+        writer->failed = true;
+        return;
+    }
+    const size_t length = dataTagSize(info->tag) * count;
+    if(writeHeader(writer, id, 3 + length) == 0xff) {
+        return;
+    }
+    writer->buffer[writer->size++] = index;
+    writer->buffer[writer->size++] = count;
+    writer->buffer[writer->size++] = count;
+    memcpy(writer->buffer + writer->size, elements, length);
+    writer->size += length;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * GET DATA and PUT DATA payloads are a list of items, each starting with a tag byte and a data ID.
+ * The tag byte:
+ * - bit 7: more items follow
+ * - bit 4-6: value type, unsigned/signed integer, float, or array
+ * - bit 2-3: value (or array element) size, 1, 2 or 4 bytes
+ *
+ * GET DATA request items are the tag and ID, arrays add an index. For example 14 18 asks for the battery level,
+ * 94 18 14 1a for the battery level and max battery level.
+ * GET DATA responses are a status byte (0x00 is Ok, 0x01 is not found), then for each item the tag, ID and value.
+ * Array values are the element count and the elements.
+ * PUT DATA requests are the tag, ID and value for each item, the response is just the status byte.
+ * Array items in a PUT DATA have an index and element count before the value.
+ * All values are big endian.
+ */
+
+#define DATA_MORE 0x80
+
+#define DATA_TYPE_MASK 0x70
+#define DATA_TYPE_UINT 0x00
+#define DATA_TYPE_INT 0x10
+#define DATA_TYPE_FLOAT 0x20
+#define DATA_TYPE_ARRAY 0x40
+
+#define DATA_SIZE_MASK 0x0c
+#define DATA_SIZE_1 0x00
+#define DATA_SIZE_2 0x04
+#define DATA_SIZE_4 0x08
+
+// Known data IDs.
+#define DATA_BAT_LEVEL 0x18
+#define DATA_BAT_LEVEL_MAX 0x1a
+#define DATA_UNKNOWN_2A 0x2a
+#define DATA_CALIBRATION_1 0x38
+#define DATA_CALIBRATION_2 0x3a
+#define DATA_MAINTENANCE_DISTANCE 0x3b
+#define DATA_SERIALS 0x5c
+#define DATA_TOTAL_DISTANCE 0x80
+#define DATA_TIME 0x8e
+#define DATA_UNKNOWN_94 0x94
+#define DATA_TRIP_TIME 0x99
+#define DATA_MAX_SPEED 0x9a
+#define DATA_MOTOR_LIMIT 0xb0
+#define DATA_BAT_VOLTAGE 0xb1
+#define DATA_SPEED 0xc0
+#define DATA_DISTANCE 0xc1
+#define DATA_UNKNOWN_DF 0xdf
+
+struct dataIdInfo {
+    uint8_t id;
+    // Tag of the value, without the more bit.
+    uint8_t tag;
+    const char *name;
+};
+
+/**
+ * One item of a GET DATA or PUT DATA payload.
+ */
+struct dataItem {
+    // Tag, including the more bit.
+    uint8_t tag;
+    uint8_t id;
+    // Array index, for array items in requests.
+    uint8_t index;
+    // The value, NULL in GET DATA requests.
+    const uint8_t *value;
+    // Amount of array elements in the value, 1 if not an array.
+    uint8_t count;
+};
+
+struct dataReader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+struct dataWriter {
+    uint8_t *buffer;
+    size_t max;
+    size_t size;
+    // Position of the tag of the last item, -1 if none yet.
+    int lastTag;
+    // Set if an ID was unknown or the buffer was too small.
+    bool failed;
+};
+
+/**
+ * Size in bytes of a value, or array element, with this tag.
+ */
+inline size_t dataTagSize(uint8_t tag) {
+    return (size_t)1 << ((tag & DATA_SIZE_MASK) >> 2);
+}
+
+inline bool dataTagArray(uint8_t tag) {
+    return (tag & DATA_TYPE_MASK) == DATA_TYPE_ARRAY;
+}
+
+/**
+ * Registry entry for a data ID, or NULL if we don't know it.
+ */
+const dataIdInfo *dataLookup(uint8_t id);
+
+void dataReaderInit(dataReader *reader, const uint8_t *data, size_t size);
+
+/**
+ * Read the next GET DATA request item, returns false at the end or if the rest is malformed.
+ */
+bool dataReadRequest(dataReader *reader, dataItem *item);
+
+/**
+ * Read the next item with a value, from a GET DATA response (after the status byte) or PUT DATA request.
+ * Returns false at the end or if the rest is malformed.
+ */
+bool dataReadValue(dataReader *reader, dataItem *item);
+
+uint32_t dataUint(const dataItem& item);
+int32_t dataInt(const dataItem& item);
+float dataFloat(const dataItem& item);
+
+void dataWriterInit(dataWriter *writer, uint8_t *buffer, size_t max);
+
+/**
+ * Add a GET DATA request item, with the tag from the registry.
+ */
+void dataWriteRequest(dataWriter *writer, uint8_t id, uint8_t index = 0);
+
+/**
+ * Add an item with a value, with the tag from the registry. Values are truncated to the size of the tag.
+ */
+void dataWriteUint(dataWriter *writer, uint8_t id, uint32_t value);
+void dataWriteInt(dataWriter *writer, uint8_t id, int32_t value);
+void dataWriteFloat(dataWriter *writer, uint8_t id, float value);
+
+/**
+ * Add an array item, elements are count times the element size of the tag, already big endian.
+ */
+void dataWriteArray(dataWriter *writer, uint8_t id, const uint8_t *elements, uint8_t count);
+
+/**
+ * Add an array item for a PUT DATA, which writes the elements starting at index.
+ */
+void dataWriteArrayPut(dataWriter *writer, uint8_t id, uint8_t index, const uint8_t *elements, uint8_t count);
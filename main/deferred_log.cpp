@@ -0,0 +1,143 @@
+#include <inttypes.h>
+#include <string.h>
+#include <atomic>
+#include "esp_log.h"
+#include "cmds.h"
+#include "deferred_log.h"
+
+static const char *TAG = "deferred_log";
+
+#define RECORD_MASK (DEFERRED_LOG_RECORDS - 1)
+
+static_assert((DEFERRED_LOG_RECORDS & RECORD_MASK) == 0, "DEFERRED_LOG_RECORDS must be a power of two");
+
+struct deferredRecord {
+    uint8_t format;
+    uint8_t payloadSize;
+    uint32_t args[DEFERRED_LOG_ARGS];
+    uint8_t payload[DEFERRED_LOG_PAYLOAD];
+};
+
+/**
+ * A bounded multi-producer, single-consumer queue (Vyukov's). Each slot has a sequence number:
+ * equal to a position means the slot is free for the record at that position,
+ * one more means that record is written and can be read.
+ * Slots store their sequence minus their index, so the all zero initial state is 'slot i free for position i'.
+ */
+struct logSlot {
+    std::atomic<uint32_t> sequence;
+    deferredRecord record;
+};
+
+static logSlot slots[DEFERRED_LOG_RECORDS];
+static std::atomic<uint32_t> writePos(0);
+static uint32_t readPos = 0;
+
+static std::atomic<uint32_t> dropped(0);
+// Dropped records already reported by logDrain().
+static uint32_t droppedReported = 0;
+
+bool logDeferred(deferredFormat format, const uint8_t *payload, size_t payloadSize, uint32_t arg0, uint32_t arg1, uint32_t arg2) {
+    uint32_t pos = writePos.load(std::memory_order_relaxed);
+    logSlot *slot;
+    while(true) {
+        const uint32_t index = pos & RECORD_MASK;
+        slot = &slots[index];
+        const int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) + index - pos);
+        if(diff == 0) {
+            if(writePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            // The record from a lap ago was not read yet.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            // Another task took this position.
+            pos = writePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    deferredRecord& record = slot->record;
+    record.format = format;
+    record.payloadSize = payloadSize < DEFERRED_LOG_PAYLOAD ? payloadSize : DEFERRED_LOG_PAYLOAD;
+    record.args[0] = arg0;
+    record.args[1] = arg1;
+    record.args[2] = arg2;
+    if(record.payloadSize > 0) {
+        memcpy(record.payload, payload, record.payloadSize);
+    }
+
+    slot->sequence.store(pos + 1 - (pos & RECORD_MASK), std::memory_order_release);
+    return true;
+}
+
+static void format(const deferredRecord& record) {
+    const uint32_t *args = record.args;
+    const uint32_t header = record.format == DLOG_UNEXPECTED ? args[2] : args[0];
+    const int target = header >> 24;
+    const int source = (header >> 16) & 0xff;
+    const int type = (header >> 8) & 0xff;
+    const int command = header & 0xff;
+
+    switch(record.format) {
+        case DLOG_WAKEUP:
+            ESP_LOGI("idle_state", "Wakeup!");
+            break;
+        case DLOG_CRC_ERROR:
+            ESP_LOGI("parser", "CRC error, message:");
+            ESP_LOG_BUFFER_HEX("parser", record.payload, record.payloadSize);
+            break;
+        case DLOG_INCOMPLETE:
+            ESP_LOGI("parser", "Incomplete message:");
+            ESP_LOG_BUFFER_HEX("parser", record.payload, record.payloadSize);
+            break;
+        case DLOG_UNEXPECTED:
+            ESP_LOGI("unexpected", "New unexpected message (%" PRIu32 " kinds, %s): Tgt:%d, Src:%d, Type:%d, Command:%d", args[0], args[1] ? "rejected" : "unknown",
+                     target, source, type, command);
+            ESP_LOG_BUFFER_HEX("unexpected", record.payload, record.payloadSize);
+            break;
+        case DLOG_INCOMING:
+            ESP_LOGI("idle_state", "Incoming: Tgt:%d, Src:%d, Type:%d, Command:%d", target, source, type, command);
+            ESP_LOG_BUFFER_HEX("idle_state", record.payload, record.payloadSize);
+            break;
+        case DLOG_PRESENCE: {
+            const char *name = nodeName(args[0]);
+            ESP_LOGI("presence", "Node %" PRIx32 " (%s) %s", args[0], name != NULL ? name : "?", args[1] ? "present" : "absent");
+            break;
+        }
+        default:
+            ESP_LOGW(TAG, "Unknown format %d", record.format);
+            break;
+    }
+}
+
+size_t logDrain() {
+    size_t drained = 0;
+    while(true) {
+        const uint32_t index = readPos & RECORD_MASK;
+        logSlot *slot = &slots[index];
+        if(slot->sequence.load(std::memory_order_acquire) + index != readPos + 1) {
+            break;
+        }
+
+        // Copy it out and free the slot before formatting, which is slow.
+        const deferredRecord record = slot->record;
+        slot->sequence.store(readPos + DEFERRED_LOG_RECORDS - index, std::memory_order_release);
+        readPos++;
+
+        format(record);
+        drained++;
+    }
+
+    const uint32_t droppedNow = dropped.load(std::memory_order_relaxed);
+    if(droppedNow != droppedReported) {
+        ESP_LOGW(TAG, "Dropped %" PRIu32 " log records (%" PRIu32 " in total)", droppedNow - droppedReported, droppedNow);
+        droppedReported = droppedNow;
+    }
+    return drained;
+}
+
+uint32_t logDropped() {
+    return dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Logging for code that must not wait on the console, like the bus parser and message handling.
+ * logDeferred(..) only copies a format ID, a few arguments and a payload into a lock-free ring,
+ * logDrain(..) formats them later, from a low priority task. When the ring is full, records are dropped and counted.
+ */
+
+// Records the ring holds, must be a power of two.
+#define DEFERRED_LOG_RECORDS (32)
+#define DEFERRED_LOG_ARGS (3)
+// Enough for a whole frame.
+#define DEFERRED_LOG_PAYLOAD (20)
+
+enum deferredFormat {
+    // No arguments.
+    DLOG_WAKEUP,
+    // Payload is the frame.
+    DLOG_CRC_ERROR,
+    DLOG_INCOMPLETE,
+    // Kinds seen so far, rejected or unknown, logFrameHeader(..). Payload is the message payload.
+    DLOG_UNEXPECTED,
+    // logFrameHeader(..). Payload is the message payload.
+    DLOG_INCOMING,
+    // Node address, 1 if present or 0 if absent.
+    DLOG_PRESENCE,
+    DLOG_FORMATS
+};
+
+/**
+ * Pack the header values of a message into one argument.
+ */
+inline uint32_t logFrameHeader(uint8_t target, uint8_t source, uint8_t type, uint8_t command) {
+    return (uint32_t)target << 24 | (uint32_t)source << 16 | (uint32_t)type << 8 | command;
+}
+
+/**
+ * Queue a record, safe from any task. Returns false if the ring was full and it was dropped.
+ * The payload is cut to DEFERRED_LOG_PAYLOAD bytes.
+ */
+bool logDeferred(deferredFormat format, const uint8_t *payload, size_t payloadSize, uint32_t arg0 = 0, uint32_t arg1 = 0, uint32_t arg2 = 0);
+
+/**
+ * Format and log all queued records, returns how many. Only call from one task.
+ */
+size_t logDrain();
+
+/**
+ * Records dropped so far because the ring was full.
+ */
+uint32_t logDropped();
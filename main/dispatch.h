@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cmds.h"
+#include "parser.h"
+
+/**
+ * Lookup table for incoming requests, built at compile time.
+ * Entries are keyed by message type, command, data ID (payload[1] for GET/PUT DATA, 0x00 otherwise)
+ * and payload size. They are placed in an open addressing hash table, so a lookup is a hash and
+ * at most maxProbe + 1 compares, however many entries there are.
+ * Entries with payload size DISPATCH_ANY_SIZE match any size not claimed by another entry, which costs a second lookup.
+ */
+
+// Hash table size, must be a power of two and well above the amount of entries.
+#define DISPATCH_SLOT_BITS 6
+#define DISPATCH_SLOTS (1 << DISPATCH_SLOT_BITS)
+
+// Payload sizes only go up to 15, so this can't be a real one.
+#define DISPATCH_ANY_SIZE 0xff
+
+template <typename Handler> struct dispatchEntry {
+    uint8_t type;
+    uint8_t command;
+    uint8_t dataId;
+    uint8_t payloadSize;
+    Handler handler;
+};
+
+constexpr uint32_t dispatchKey(uint8_t type, uint8_t command, uint8_t dataId, uint8_t payloadSize) {
+    return ((uint32_t)type << 24) | ((uint32_t)command << 16) | ((uint32_t)dataId << 8) | payloadSize;
+}
+
+constexpr uint32_t dispatchHash(uint32_t key) {
+    // Fibonacci hashing, the top bits of the product are well mixed.
+    return (key * 0x9e3779b1u) >> (32 - DISPATCH_SLOT_BITS);
+}
+
+/**
+ * The data ID of a message, as used in the key.
+ */
+constexpr uint8_t dispatchDataId(const frameView& message) {
+    if(message.type == MSG_CMD_REQ && (message.command == CMD_GET_DATA || message.command == CMD_PUT_DATA) && message.payloadSize >= 2) {
+        return message.payload[1];
+    }
+    return 0x00;
+}
+
+template <typename Handler, size_t N> struct dispatchTable {
+    dispatchEntry<Handler> entries[N];
+
+    // Index of the entry + 1 for each slot, 0 for an empty slot.
+    uint8_t slots[DISPATCH_SLOTS];
+
+    // Most extra slots any entry is away from its hash slot.
+    uint8_t maxProbe;
+
+    // False if two entries have the same key.
+    bool unique;
+
+    /**
+     * Find the entry for a message, returns its index, or -1 if there is none.
+     */
+    constexpr int find(const frameView& message) const {
+        const uint8_t dataId = dispatchDataId(message);
+        const int index = find(dispatchKey(message.type, message.command, dataId, message.payloadSize));
+        if(index >= 0) {
+            return index;
+        }
+        return find(dispatchKey(message.type, message.command, dataId, DISPATCH_ANY_SIZE));
+    }
+
+    constexpr int find(uint32_t key) const {
+        uint32_t slot = dispatchHash(key);
+        for(uint8_t probe = 0; probe <= maxProbe; probe++) {
+            const uint8_t index = slots[slot];
+            if(index == 0) {
+                return -1;
+            }
+            const dispatchEntry<Handler>& entry = entries[index - 1];
+            if(dispatchKey(entry.type, entry.command, entry.dataId, entry.payloadSize) == key) {
+                return index - 1;
+            }
+            slot = (slot + 1) & (DISPATCH_SLOTS - 1);
+        }
+        return -1;
+    }
+};
+
+template <typename Handler, size_t N> constexpr dispatchTable<Handler, N> makeDispatchTable(const dispatchEntry<Handler> (&entries)[N]) {
+    static_assert(N < DISPATCH_SLOTS / 2, "Too many dispatch entries, increase DISPATCH_SLOT_BITS");
+
+    dispatchTable<Handler, N> table = {};
+    table.unique = true;
+    for(size_t index = 0; index < N; index++) {
+        table.entries[index] = entries[index];
+
+        const dispatchEntry<Handler>& entry = entries[index];
+        const uint32_t key = dispatchKey(entry.type, entry.command, entry.dataId, entry.payloadSize);
+        uint32_t slot = dispatchHash(key);
+        uint8_t probe = 0;
+        while(table.slots[slot] != 0) {
+            const dispatchEntry<Handler>& other = entries[table.slots[slot] - 1];
+            if(dispatchKey(other.type, other.command, other.dataId, other.payloadSize) == key) {
+                table.unique = false;
+            }
+            slot = (slot + 1) & (DISPATCH_SLOTS - 1);
+            probe++;
+        }
+        table.slots[slot] = index + 1;
+        if(probe > table.maxProbe) {
+            table.maxProbe = probe;
+        }
+    }
+    return table;
+}
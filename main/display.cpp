@@ -1,42 +1,15 @@
-#include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
-#include "freertos/timers.h"
 #include "states/states.h"
 #include "trip.h"
 #include "relays.h"
 #include "bat.h"
 #include "cu2.h"
 #include "cu3.h"
+#include "scheduler.h"
 #include "display.h"
 
-static EventGroupHandle_t eventGroupHandle;
-static TimerHandle_t displayUpdateTimer;
-
-#if CONFIG_ION_CU2 || CONFIG_ION_CU3
-static const int DISPLAY_UPDATE_BIT = BIT0;
-#endif
-
-
-static void displayUpdateTimerCallback(TimerHandle_t xTimer) { requestDisplayUpdate(); }
-
-void initDisplay() {
-    eventGroupHandle = xEventGroupCreate();
-    displayUpdateTimer = xTimerCreate("displayUpdateTimer", (1500 / portTICK_PERIOD_MS), pdTRUE, (void *)0, displayUpdateTimerCallback);
-}
-
-void requestDisplayUpdate() {
-#if CONFIG_ION_CU2 || CONFIG_ION_CU3
-    xEventGroupSetBits(eventGroupHandle, DISPLAY_UPDATE_BIT);
-#endif
-}
-
-void startDisplayUpdates() {
-    xTimerStart(displayUpdateTimer, 0);
-}
-
-void stopDisplayUpdates() {
-    xTimerStop(displayUpdateTimer, 0);
-}
+// Refresh the display at least this often, sooner if there's room in a control window.
+#define DISPLAY_UPDATE_MIN_MS 1000
+#define DISPLAY_UPDATE_MAX_MS 1500
 
 static void displayUpdate(ion_state * state) {
 #if CONFIG_ION_CU2
@@ -63,24 +36,22 @@ static void displayUpdate(ion_state * state) {
 #endif
 }
 
-bool handleDisplayUpdate(ion_state * state) {
-#if CONFIG_ION_CU2
-    if(cu2HandleDisplayUpdate()) {
-        return true;
-    }
-#endif
+static void displayUpdateJob(void *context) { displayUpdate((ion_state *)context); }
 
+void initDisplay() {
 #if CONFIG_ION_CU2 || CONFIG_ION_CU3
-    EventBits_t bitsToCheck =  DISPLAY_UPDATE_BIT;
+    schedulerAdd(JOB_DISPLAY_UPDATE, displayUpdateJob, 1, DISPLAY_UPDATE_MIN_MS, DISPLAY_UPDATE_MAX_MS);
+#endif
+}
 
-    EventBits_t bits = xEventGroupWaitBits(eventGroupHandle, bitsToCheck, false, false, 0);
-    if((bits & DISPLAY_UPDATE_BIT) != 0) {
-        xEventGroupClearBits(eventGroupHandle, DISPLAY_UPDATE_BIT);
-        displayUpdate(state);
-        xTimerReset(displayUpdateTimer, 0);
-        return true;
-    }
+void requestDisplayUpdate() {
+    schedulerRequest(JOB_DISPLAY_UPDATE);
+}
 
-#endif
-    return false;
+void startDisplayUpdates() {
+    schedulerStart(JOB_DISPLAY_UPDATE);
+}
+
+void stopDisplayUpdates() {
+    schedulerStop(JOB_DISPLAY_UPDATE);
 }
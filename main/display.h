@@ -6,4 +6,3 @@ void initDisplay();
 void requestDisplayUpdate();
 void startDisplayUpdates();
 void stopDisplayUpdates();
-bool handleDisplayUpdate(ion_state * state);
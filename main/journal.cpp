@@ -0,0 +1,158 @@
+#include <stddef.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "crc8.h"
+#include "journal.h"
+
+static const char *TAG = "journal";
+
+// Data partition subtype of the odometer partition, see partitions.csv.
+#define JOURNAL_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x41)
+
+#define JOURNAL_EMPTY 0xffffffff
+
+static const esp_partition_t *partition = NULL;
+static uint32_t slotsPerSector = 0;
+static uint32_t slots = 0;
+
+// Where the next record goes.
+static uint32_t nextSlot = 0;
+static uint32_t nextSequence = 0;
+
+static journalRecord newest = {};
+static bool found = false;
+
+static uint8_t recordCrc(const journalRecord& record) {
+    return crc8_bow((const uint8_t *)&record, offsetof(journalRecord, crc));
+}
+
+static size_t slotOffset(uint32_t slot) {
+    return (slot / slotsPerSector) * partition->erase_size + (slot % slotsPerSector) * sizeof(journalRecord);
+}
+
+static bool readSlot(uint32_t slot, journalRecord *record) {
+    return esp_partition_read(partition, slotOffset(slot), record, sizeof(*record)) == ESP_OK;
+}
+
+static bool recordValid(const journalRecord& record) {
+    return record.sequence != JOURNAL_EMPTY && record.magic == JOURNAL_MAGIC && record.crc == recordCrc(record);
+}
+
+static bool slotEmpty(const journalRecord& record) {
+    const uint8_t *bytes = (const uint8_t *)&record;
+    for(size_t pos = 0; pos < sizeof(record); pos++) {
+        if(bytes[pos] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool journalInit() {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE, "odometer");
+    if(partition == NULL) {
+        ESP_LOGW(TAG, "No odometer partition");
+        return false;
+    }
+    const uint32_t sectors = partition->size / partition->erase_size;
+    if(sectors < 2) {
+        // Erasing the only sector would lose the newest record.
+        ESP_LOGW(TAG, "Odometer partition needs at least 2 sectors");
+        partition = NULL;
+        return false;
+    }
+    slotsPerSector = partition->erase_size / sizeof(journalRecord);
+    slots = sectors * slotsPerSector;
+
+    // Sectors are filled in order, the one that starts with the highest sequence has the newest record.
+    journalRecord record;
+    int32_t newestSector = -1;
+    uint32_t newestStart = 0;
+    for(uint32_t sector = 0; sector < sectors; sector++) {
+        if(readSlot(sector * slotsPerSector, &record) && recordValid(record) && (newestSector < 0 || record.sequence > newestStart)) {
+            newestSector = sector;
+            newestStart = record.sequence;
+        }
+    }
+
+    nextSlot = 0;
+    nextSequence = 0;
+    found = false;
+    if(newestSector < 0) {
+        ESP_LOGI(TAG, "Odometer journal is empty");
+        return true;
+    }
+
+    // Up to the first unwritten slot, a torn record is skipped.
+    const uint32_t first = newestSector * slotsPerSector;
+    nextSlot = first + slotsPerSector;
+    for(uint32_t slot = first; slot < first + slotsPerSector; slot++) {
+        if(!readSlot(slot, &record) || slotEmpty(record)) {
+            nextSlot = slot;
+            break;
+        }
+        if(recordValid(record) && (!found || record.sequence > newest.sequence)) {
+            newest = record;
+            found = true;
+        }
+    }
+    nextSlot %= slots;
+    nextSequence = newest.sequence + 1;
+
+    ESP_LOGI(TAG, "Odometer record %" PRIu32 " at slot %" PRIu32 ", total %" PRIu32, newest.sequence, nextSlot, newest.total);
+    return true;
+}
+
+bool journalLoad(tripData *data) {
+    if(!found) {
+        return false;
+    }
+    data->trip1 = newest.trip1;
+    data->trip2 = newest.trip2;
+    data->total = newest.total;
+    return true;
+}
+
+bool journalAppend(const tripData& data) {
+    if(partition == NULL) {
+        return false;
+    }
+
+    const uint32_t slot = nextSlot;
+    nextSlot = (nextSlot + 1) % slots;
+
+    if(slot % slotsPerSector == 0) {
+        const esp_err_t err = esp_partition_erase_range(partition, slotOffset(slot), partition->erase_size);
+        if(err != ESP_OK) {
+            ESP_LOGW(TAG, "Erasing odometer sector %" PRIu32 " failed (%d)", slot / slotsPerSector, err);
+            // Not writable, move on to the next sector.
+            nextSlot = (slot + slotsPerSector) % slots;
+            return false;
+        }
+    }
+
+    journalRecord record = {};
+    record.sequence = nextSequence;
+    record.trip1 = data.trip1;
+    record.trip2 = data.trip2;
+    record.total = data.total;
+    record.magic = JOURNAL_MAGIC;
+    record.reserved = 0xff;
+    record.crc = recordCrc(record);
+
+    const esp_err_t err = esp_partition_write(partition, slotOffset(slot), &record, sizeof(record));
+    if(err != ESP_OK) {
+        // The slot may be partly written, the next record goes after it.
+        // Unless it starts the sector, then the sector would not be found at start, erase it again instead.
+        ESP_LOGW(TAG, "Writing odometer record failed (%d)", err);
+        if(slot % slotsPerSector == 0) {
+            nextSlot = slot;
+        }
+        return false;
+    }
+    nextSequence++;
+    newest = record;
+    found = true;
+    return true;
+}
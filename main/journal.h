@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+#include "trip.h"
+
+/**
+ * Append-only journal of the distances, on the odometer partition (see partitions.csv).
+ * Each record holds all distances with a sequence number and a CRC, so only the newest valid record matters:
+ * a record torn by a power loss costs that one save, not the ride.
+ * Records are written one after the other, going round through the sectors of the partition.
+ * A sector is erased when writing reaches it, the newest record is always in another sector by then.
+ * Only used from the main task.
+ */
+
+#define JOURNAL_MAGIC 0x4f44 // "OD"
+
+struct journalRecord {
+    // Counts up with each record, 0xffffffff is an unwritten slot.
+    uint32_t sequence;
+    uint32_t trip1;
+    uint32_t trip2;
+    uint32_t total;
+    uint16_t magic;
+    uint8_t reserved;
+    // CRC of the fields before it.
+    uint8_t crc;
+};
+
+/**
+ * Find the partition and the newest record. Returns false if there is no usable partition.
+ */
+bool journalInit();
+
+/**
+ * The distances of the newest record. Returns false if there are none.
+ */
+bool journalLoad(tripData *data);
+
+/**
+ * Write a record. Returns false if there is no partition, or writing failed.
+ */
+bool journalAppend(const tripData& data);
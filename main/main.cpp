@@ -11,12 +11,19 @@
 #include "freertos/event_groups.h"
 #include "freertos/timers.h"
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "nvs_flash.h"
 #include "bytes.h"
 #include "button.h"
 #include "bow.h"
+#include "clock.h"
+#include "rtt.h"
+#include "bus_stats.h"
+#include "presence.h"
+#include "deferred_log.h"
+#include "trace.h"
 #include "cmds.h"
 #include "blink.h"
 #if CONFIG_ION_CU2
@@ -31,10 +38,16 @@
 #include "motor.h"
 #include "relays.h"
 #include "trip.h"
+#include "retained.h"
 #include "calibration.h"
+#include "crc8_bench.h"
+#include "states/machine.h"
 #include "states/states.h"
 #include "ctrl_event_group.h"
 #include "msg_handling.h"
+#include "pairing.h"
+#include "scheduler.h"
+#include "unexpected.h"
 
 static const char *TAG = "app";
 
@@ -46,6 +59,10 @@ static const char *TAG = "app";
     #define SECOND_CPU PRO_CPU_NUM
 #endif
 
+// Below everything that talks on the bus.
+#define LOG_TASK_PRIORITY (1)
+#define LOG_DRAIN_INTERVAL (100 / portTICK_PERIOD_MS)
+
 #if CONFIG_ION_BUTTON
     #define BUTTON ((gpio_num_t)CONFIG_ION_BUTTON_BOARD_PIN)
     #define BUTTON_EXT ((gpio_num_t)CONFIG_ION_BUTTON_EXTERNAL_PIN)
@@ -55,11 +72,37 @@ static const char *TAG = "app";
     #define CHARGE_PIN ((gpio_num_t)CONFIG_ION_CHARGE_PIN)
 #endif
 
-static TimerHandle_t measureBatTimer;
+// Longest the main loop sleeps with nothing to do. Also how late the charging state notices its 3 seconds passed.
+#define PARKED_WAIT_US (1000 * 1000)
+
+// What wakes up the main loop, besides jobs that are due, see scheduler.h.
+static const EventBits_t WORK_BITS = BUTTON_MODE_SHORT_PRESS_BIT | BUTTON_MODE_LONG_PRESS_BIT | BUTTON_LIGHT_SHORT_PRESS_BIT | BUTTON_LIGHT_LONG_PRESS_BIT |
+                                     WAKEUP_BIT | CALIBRATE_BIT | BUS_RX_BIT | CHARGE_PIN_BIT;
+
+// Time for our own requests each time we have control of the bus, before handing off, see controlWindowEnd(..).
+#define CONTROL_WINDOW_US ((int64_t)CONFIG_ION_CONTROL_WINDOW_MS * 1000)
 
-static void measureBatTimerCallback(TimerHandle_t xTimer) {
-    setControlBits(MEASURE_BAT_BIT);
+#if CONFIG_ION_ADC
+#define MEASURE_BAT_MS 100
+
+static void measureBatJob(void *context) {
+    measureBat();
 }
+#endif
+
+#if CONFIG_ION_BUS_STATS_INTERVAL > 0
+static void busStatsJob(void *context) {
+    statsLog();
+    unexpectedLog();
+    stateLog();
+}
+#endif
+
+#if CONFIG_ION_CHARGE
+static void IRAM_ATTR chargePinIsr(void *arg) {
+    setControlBitsFromISR(CHARGE_PIN_BIT);
+}
+#endif
 
 #if CONFIG_ION_KEEPALIVE
 volatile bool myTaskAlive = false;
@@ -67,30 +110,115 @@ TimerHandle_t healthCheckTimer ;
 
 static void checkMyTaskHealth(TimerHandle_t xTimer) {
     if (!myTaskAlive) {
-        saveDistances();
+#if CONFIG_ION_TRACE
+        // Written out after the restart, like after a panic. Erasing flash here would hold up the timer task.
+        traceFlushAfterReset(TRACE_KEEPALIVE);
+#endif
+#if CONFIG_ION_RESUME
+        retainedMarkKeepalive();
+#endif
+        // No saving distances from here, flash writes belong to the main task. The odometer journal has them up to a bit ago.
         esp_restart();
     }
     myTaskAlive = false;  // Reset voor volgende check
 }
 #endif
 
-static void doHandoff(ion_state * state) {
+// Who gets the bus, in order of preference. Absent nodes are skipped, see presence.h.
+static const uint8_t handoffTargets[] = {
 #if CONFIG_ION_CU3
-    uint8_t handoffTarget = MSG_DISPLAY;
-#else
-    uint8_t handoffTarget = MSG_MOTOR;
+    MSG_DISPLAY,
 #endif
-    writeMessage(handoffMsg(handoffTarget));
+    MSG_MOTOR,
+};
+#define HANDOFF_TARGETS (sizeof(handoffTargets) / sizeof(handoffTargets[0]))
+
+/**
+ * Ping an absent node to see if it's back, an answer marks it present (see readEvent(..)).
+ * An answer after the wait still does when it arrives, the exchange or handoff it arrives in drops it as stale.
+ */
+static void probeNode(uint8_t node) {
+    busTransaction transaction;
+    exchangeStart(&transaction, pingReq(node, MSG_BMS), 1, PRESENCE_PROBE_WAIT_MS * 1000);
+    if(exchangeAwait(&transaction) != MSG_OK) {
+        presenceMissed(node, clockNowUs());
+    }
+}
+
+/**
+ * Find the first handoff target from 'first' on that is there, probing absent ones that are due.
+ * Returns its index, or -1 if none are there.
+ */
+static int pickHandoffTarget(size_t first) {
+    int64_t now = clockNowUs();
+    int64_t nextProbe = INT64_MAX;
+    for(size_t index = first; index < HANDOFF_TARGETS; index++) {
+        const uint8_t node = handoffTargets[index];
+        if(presenceProbeDue(node, now)) {
+            probeNode(node);
+            now = clockNowUs();
+        }
+        if(presenceAvailable(node)) {
+            return index;
+        }
+        if(presenceGet(node)->nextProbe < nextProbe) {
+            nextProbe = presenceGet(node)->nextProbe;
+        }
+    }
+
+    // Nobody to hand off to, the bus stays quiet. Don't spin until the next probe, but don't block the main loop long either.
+    if(nextProbe != INT64_MAX && nextProbe > now) {
+        const int64_t waitUs = nextProbe - now < PRESENCE_PROBE_WAIT_MS * 1000 ? nextProbe - now : PRESENCE_PROBE_WAIT_MS * 1000;
+        vTaskDelay(usToTicks(waitUs));
+    }
+    return -1;
+}
+
+/**
+ * Nobody took control, or nobody answered it.
+ */
+static void endHandoffs(ion_state * state) {
+#if CONFIG_ION_CU2
+    stopButtonCheck();
+#endif
+    stateEvent(state, EV_QUIET);
+}
+
+static void doHandoff(ion_state * state) {
+    int targetIndex = pickHandoffTarget(0);
+    if(targetIndex < 0) {
+        endHandoffs(state);
+        return;
+    }
+    uint8_t handoffTarget = handoffTargets[targetIndex];
+    writeFrame(handoffFrame(handoffTarget));
+    int64_t lastActivity = txDoneUs();
 
     while(true) {
         // Keep handling responses, and subsequent incoming messages, until someone hands off back to us.
         bool sawValidMessage = false;
-        messageType message = {};
+        rxEvent event = {};
+        const frameView& message = event.message;
         readResult readResult;
+        bool stale;
         do {
-            // Replies to handoff should be a lot quicker then 250ms
-            readResult = readMessage(&message, 250 / portTICK_PERIOD_MS);
-            if(readResult == MSG_OK &&
+            // Wait as long as the bus is normally quiet during a handoff, see rtt.h.
+            // Counted from the end of what we sent last, which may still be going out. At least a tick, 0 is forever.
+            const int64_t quietUs = lastActivity + rttTimeoutUs(handoffTarget, RTT_HANDOFF) - clockNowUs();
+            readResult = readEvent(&event, quietUs > 0 ? usToTicks(quietUs) : 1);
+            // We wait for no answers while handing off, a response to us is late, e.g. to a probe we gave up on.
+            // readEvent(..) noted its sender is there, it says nothing about the handoff.
+            stale = readResult == MSG_OK && message.target == MSG_BMS && (message.type == MSG_CMD_RESP || message.type == MSG_PING_RESP);
+            if(stale) {
+                statsAdd(STAT_STALE_REPLIES);
+            }
+            if(readResult != MSG_TIMEOUT && event.time > lastActivity) {
+                if(!stale) {
+                    rttSample(handoffTarget, RTT_HANDOFF, event.time - lastActivity);
+                }
+                lastActivity = event.time;
+            }
+            if(readResult == MSG_OK && !stale &&
                 (message.source == handoffTarget ||
                 (message.type == MSG_HANDOFF && message.target != handoffTarget))) {
                 // We saw a good message from our target, or another handoff message (to another target). So probably it accepted the handoff.
@@ -101,22 +229,26 @@ static void doHandoff(ion_state * state) {
                 // The target is likely not listening or turned off.
                 // E.g. CU3 removed, or XHP motor turned off (Toprun motor seems to stay chatty even when 'off').
                 // Or some messages got mangled/lost somehow (probably seen as CRC error) and now everyone is waiting.
-
-                if(handoffTarget == MSG_DISPLAY && !sawValidMessage) {
-                    // Let's assume the CU3 display is removed, handoff to motor instead.
-                    // TODO: We should remember this, and ping the display now and then to see if it's back.
-                    handoffTarget = MSG_MOTOR;
-                    writeMessage(handoffMsg(handoffTarget));
-                    continue; // I'd prefer to jump to the outer loop, but this is good enough..
+                statsAdd(STAT_HANDOFF_TIMEOUTS);
+                if(sawValidMessage) {
+                    // The target did respond, so it may just be slower than we thought. Wait longer next time.
+                    // A target that never responded says nothing about its speed, it might be gone.
+                    rttTimeout(handoffTarget, RTT_HANDOFF);
+                } else {
+                    // A few of these in a row and we skip it until a probe finds it back, so we don't pay this timeout every cycle.
+                    presenceMissed(handoffTarget, clockNowUs());
+
+                    // E.g. the CU3 display is removed, handoff to the next one (the motor) instead.
+                    targetIndex = pickHandoffTarget(targetIndex + 1);
+                    if(targetIndex >= 0) {
+                        handoffTarget = handoffTargets[targetIndex];
+                        writeFrame(handoffFrame(handoffTarget));
+                        lastActivity = txDoneUs();
+                        continue; // I'd prefer to jump to the outer loop, but this is good enough..
+                    }
                 }
 
-#if CONFIG_ION_CU2
-                stopButtonCheck();
-#endif
-                if(state->state == MOTOR_OFF) {
-                    state->doHandoffs = false;
-                    toIdleState(state);
-                }
+                endHandoffs(state);
                 return;
             }
 
@@ -124,10 +256,13 @@ static void doHandoff(ion_state * state) {
             // - Messages with CRC error
             // - Wakeup messages (we are already awake)
             // - Message not addressed to us
-        } while(readResult != MSG_OK || message.target != MSG_BMS);
+            // - Late responses
+        } while(readResult != MSG_OK || message.target != MSG_BMS || stale);
 
         // A message was sent to us, deal with it.
         messageHandlingResult handleResult = handleMessage(message, state);
+        // Including sending our reply, if any.
+        lastActivity = txDoneUs();
         if(handleResult == CONTROL_TO_US) {
             // There was a handoff to us, so we're back in control. Exit the loop.
             return;
@@ -135,11 +270,50 @@ static void doHandoff(ion_state * state) {
     }
 }
 
-// TODO
-static void readTask(void *pvParameter) {
-    // To RTOS stream
-    while(true) {
+/**
+ * Answer requests addressed to us that arrive while we wait for a response to our own.
+ */
+static void handleRequest(const frameView& message, void *context) {
+    handleMessage(message, (ion_state *)context);
+}
+
+/**
+ * States that only wait for something to happen: bus data, a button, a timer or the charge pin.
+ * Others run through their steps, or wait on the bus while doing handoffs.
+ */
+static bool isParked(const ion_state * state) {
+    return !state->doHandoffs && (state->state == IDLE || state->state == MOTOR_OFF || state->state == CHARGING);
+}
+
+/**
+ * Until when we may keep the bus to ourselves. Without handoffs nobody else is waiting.
+ */
+static int64_t controlWindowEnd(const ion_state * state, int64_t controlStart) {
+    return state->doHandoffs ? controlStart + CONTROL_WINDOW_US : INT64_MAX;
+}
 
+/**
+ * Sleep until there's something to do: a job is due, or any of WORK_BITS is set. At most PARKED_WAIT_US.
+ * The bits stay set for whoever handles them, BUS_RX_BIT until the bus is read empty, see pollEvent(..).
+ */
+static void waitForWork() {
+    const int64_t now = clockNowUs();
+    int64_t waitUs = schedulerNextDue() - now;
+    if(waitUs > PARKED_WAIT_US) {
+        waitUs = PARKED_WAIT_US;
+    }
+    waitControlBits(WORK_BITS, false, false, waitUs > 0 ? usToTicks(waitUs) : 0);
+    // Before the pin is checked, so a change from here on wakes us up next time.
+    clearControlBits(CHARGE_PIN_BIT);
+}
+
+/**
+ * Formats what the bus code logged with logDeferred(..), so the console never holds up a reply.
+ */
+static void logTask(void *pvParameter) {
+    while(true) {
+        logDrain();
+        vTaskDelay(LOG_DRAIN_INTERVAL);
     }
 
     vTaskDelete(NULL);
@@ -157,8 +331,15 @@ static void my_task(void *pvParameter) {
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pull_up_en = GPIO_PULLUP_ENABLE;
     io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
-    io_conf.intr_type = GPIO_INTR_DISABLE;
+    io_conf.intr_type = GPIO_INTR_ANYEDGE;
     ESP_ERROR_CHECK(gpio_config(&io_conf));
+
+    // Someone else may have installed the service already.
+    const esp_err_t isrResult = gpio_install_isr_service(0);
+    if(isrResult != ESP_OK && isrResult != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(isrResult);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CHARGE_PIN, chargePinIsr, NULL));
 #endif
 
     initBlink();
@@ -170,6 +351,7 @@ static void my_task(void *pvParameter) {
     initUart();
 
     loadDistances();
+    initPairing();
 
 #if CONFIG_ION_CU2
     initCu2();
@@ -178,9 +360,16 @@ static void my_task(void *pvParameter) {
     initDisplay();
     initMotor();
 
-    measureBatTimer = xTimerCreate("measureBatTimer", (100 / portTICK_PERIOD_MS), pdTRUE, (void *)0, measureBatTimerCallback);
-    xTimerStart(measureBatTimer, 0);
-	
+#if CONFIG_ION_ADC
+    schedulerAdd(JOB_MEASURE_BAT, measureBatJob, 3, MEASURE_BAT_MS, MEASURE_BAT_MS);
+    schedulerStart(JOB_MEASURE_BAT);
+#endif
+
+#if CONFIG_ION_BUS_STATS_INTERVAL > 0
+    schedulerAdd(JOB_BUS_STATS, busStatsJob, 4, CONFIG_ION_BUS_STATS_INTERVAL * 1000, CONFIG_ION_BUS_STATS_INTERVAL * 1000);
+    schedulerStart(JOB_BUS_STATS);
+#endif
+
 #if CONFIG_ION_KEEPALIVE
     healthCheckTimer = xTimerCreate("healthCheckTimer", 60000 / portTICK_PERIOD_MS, pdTRUE, NULL, checkMyTaskHealth);
     xTimerStart(healthCheckTimer, 0);
@@ -195,8 +384,24 @@ static void my_task(void *pvParameter) {
         .doHandoffs = false,
         .motorOffAck = false,
         .level = 0,
-        .speed = 0
+        .speed = 0,
+        .wokenAt = 0,
+        .lastMoving = 0
     };
+#if CONFIG_ION_RESUME
+    const retainedState *resume = retainedGet();
+    if(resume != NULL) {
+        restoreDistances(resume->trip, resume->motorDistance);
+        setLight(resume->light);
+        state.level = resume->level;
+        if(resume->motorOn) {
+            resumeTurnMotorOnState(&state);
+        }
+    }
+#endif
+    stateInit(&controlMachine, &state);
+
+    setRequestHandler(handleRequest, &state);
 
     while(true) {
 
@@ -204,31 +409,32 @@ static void my_task(void *pvParameter) {
         myTaskAlive = true;  // sign of life
 #endif
 
-        // TODO:
-        // More use of timeouts
-        // See if we really need 8k stack (copying message structure a lot I guess)
-
-        // TODO:
-        // Instead .. ? can we wait on event bits AND rx?
-        // Serial should lead, buttons are uncommon.
-        // Can we generate a eventgroup bit from uart?
-
+        if(isParked(&state)) {
+            waitForWork();
+        }
+        // We have the bus from here, until we hand it off.
+        const int64_t controlStart = clockNowUs();
 
 #if CONFIG_ION_CHARGE
         // Charge pin is pulled to ground to activate.
         const bool chargePin = gpio_get_level(CHARGE_PIN) == 0;
-        if(chargePin && state.state != CHARGING) {
-            toChargingState(&state);
+        if(chargePin) {
+            stateEvent(&state, EV_CHARGER_IN);
         }
+#else
+        const bool chargePin = false;
 #endif
 
         EventBits_t buttonBits = waitControlBits(BUTTON_MODE_SHORT_PRESS_BIT | BUTTON_MODE_LONG_PRESS_BIT | BUTTON_LIGHT_SHORT_PRESS_BIT | BUTTON_LIGHT_LONG_PRESS_BIT | WAKEUP_BIT | CALIBRATE_BIT, true, false, 0);
-        const bool modeShortPress = (buttonBits & BUTTON_MODE_SHORT_PRESS_BIT) != 0;
         const bool modeLongPress = (buttonBits & BUTTON_MODE_LONG_PRESS_BIT) != 0;
         const bool lightShortPress = (buttonBits & BUTTON_LIGHT_SHORT_PRESS_BIT) != 0;
-        const bool lightLongPress = (buttonBits & BUTTON_LIGHT_LONG_PRESS_BIT) != 0;
-        const bool wakeup = (buttonBits & WAKEUP_BIT) != 0;
-        const bool calibrate = (buttonBits & CALIBRATE_BIT) != 0;
+        state_inputs inputs = {
+            .modeShortPress = (buttonBits & BUTTON_MODE_SHORT_PRESS_BIT) != 0,
+            .lightLongPress = (buttonBits & BUTTON_LIGHT_LONG_PRESS_BIT) != 0,
+            .calibrate = (buttonBits & CALIBRATE_BIT) != 0,
+            .wakeup = (buttonBits & WAKEUP_BIT) != 0,
+            .chargePin = chargePin
+        };
 
         if(lightShortPress) {
             toggleLight();
@@ -240,35 +446,29 @@ static void my_task(void *pvParameter) {
             requestDisplayUpdate();
         }
 
-#if CONFIG_ION_ADC
-        EventBits_t bitsToCheck = MEASURE_BAT_BIT;
-        EventBits_t bits = waitControlBits(bitsToCheck, false, false, 0);
-        if((bits & MEASURE_BAT_BIT) != 0) {
-            clearControlBits(MEASURE_BAT_BIT);
-            measureBat();
-        } else
-#endif
-        if(handleDisplayUpdate(&state)) {
-        } else if(handleMotorUpdate()) {
-        } else if(state.state == IDLE) {
-            handleIdleState(&state, modeShortPress);
-        } else if(state.state == TURN_MOTOR_ON) {
-            handleTurnMotorOnState(&state);
-        } else if(state.state == MOTOR_ON) {
-            handleMotorOnState(&state, modeShortPress, lightLongPress, calibrate);
-#if CONFIG_ION_CHARGE
-        } else if(state.state == CHARGING)  {
-            handleChargingState(&state, chargePin);
+        // Run state steps back to back while we have the bus, instead of one step per handoff round trip.
+        // Presses and such are for the first step only.
+        bool progressed;
+        do {
+            const control_state stateBefore = state.state;
+            const uint8_t stepBefore = state.step;
+
+            stateStep(&state, inputs);
+
+            inputs.modeShortPress = false;
+            inputs.lightLongPress = false;
+            inputs.calibrate = false;
+            inputs.wakeup = false;
+            // A step that is waiting for something ends the window, like the motor not answering yet.
+            progressed = state.state != stateBefore || state.step != stepBefore;
+        } while(progressed && !isParked(&state) && clockNowUs() < controlWindowEnd(&state, controlStart));
+
+#if CONFIG_ION_RESUME
+        retainedUpdate(&state);
 #endif
-        } else if(state.state == START_CALIBRATE) {
-            handleCalibrateState(&state);
-        } else if(state.state == SET_ASSIST_LEVEL) {
-            handleSetAssistLevelState(&state);       
-        } else if(state.state == TURN_MOTOR_OFF) {
-            handleTurnMotorOffState(&state);
-        } else if(state.state == MOTOR_OFF) {
-            handleMotorOffState(&state, modeShortPress, wakeup);
-        }
+
+        // Fill what's left of our time on the bus with periodic requests.
+        schedulerRun(&state, controlWindowEnd(&state, controlStart));
 
         if(state.doHandoffs) {
             doHandoff(&state);
@@ -288,8 +488,22 @@ extern "C" void app_main() {
     }
     ESP_ERROR_CHECK(ret);
 
+#if CONFIG_ION_CRC8_BENCHMARK
+    crc8Benchmark();
+#endif
+
+#if CONFIG_ION_TRACE
+    // Before the UART starts, so the trace of a crash is written out before it's overwritten.
+    traceInit();
+#endif
+
+#if CONFIG_ION_RESUME
+    retainedInit();
+#endif
+
     initControlEventGroup();
 
+    xTaskCreatePinnedToCore(logTask, "logTask", 3072, NULL, LOG_TASK_PRIORITY, NULL, FIRST_CPU);
     xTaskCreatePinnedToCore(my_task, "my_task", 4096 * 2, NULL, 5, NULL, SECOND_CPU);
 
 #if CONFIG_ION_BUTTON
@@ -0,0 +1,19 @@
+#include "crc8.h"
+#include "transport.h"
+#include "bus_stats.h"
+#include "message.h"
+
+size_t encodeMessage(const messageType& message, uint8_t *out) {
+    return encodeFrame(message, out, crc8_bow_byte);
+}
+
+void writeMessage(const messageType& message) {
+    uint8_t encoded[FRAME_MAX_ENCODED_SIZE];
+    transportWrite(encoded, encodeMessage(message, encoded));
+    statsTxFrame(message.target, message.type);
+}
+
+void writeFrame(const constFrame& frame) {
+    transportWrite(frame.bytes, frame.length);
+    statsTxFrame(frame.target, frame.type);
+}
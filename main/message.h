@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <initializer_list>
+#include "crc8.h"
+
+#define MSG_HANDOFF 0x0
+#define MSG_CMD_REQ 0x1
+#define MSG_CMD_RESP 0x2
+#define MSG_PING_REQ 0x4
+#define MSG_PING_RESP 0x3
+
+#define MSG_MOTOR 0x0
+#define MSG_BMS 0x2
+#define MSG_DISPLAY 0xC
+
+// Payload length is indicated by one nibble, so max value 0xF (15).
+// Payload length excludes the starting byte, 2 header bytes, command byte, and crc byte.
+// So total length = payload + 5, and max length is 15 + 5 = 20.
+#define FRAME_MAX_SIZE (20)
+
+// Every byte after the start byte could be a 0x10 that needs escaping.
+#define FRAME_MAX_ENCODED_SIZE (FRAME_MAX_SIZE * 2)
+
+// A message to send, received messages are a frameView.
+struct messageType {
+    // The target of the message
+    uint8_t target;
+    // The source of the message, 0x00 if not used (check type)
+    uint8_t source;
+    // The type of the message
+    uint8_t type;
+    // The command byte of the message, 0x00 if not used (check type)
+    uint8_t command;
+
+    // The payload of the message, and it's length.
+    // Payload length is indicated by one nibble, so max value 0xF (15).
+    uint8_t payload[15];
+    size_t payloadSize;
+};
+
+// Room for frames with up to 7 payload bytes, escaped. See constFrame.
+#define CONST_FRAME_SIZE (24)
+
+/**
+ * A frame that never changes, encoded at compile time with makeConstFrame(..), sent with writeFrame(..).
+ */
+struct constFrame {
+    uint8_t bytes[CONST_FRAME_SIZE];
+    uint8_t length;
+    // For the statistics.
+    uint8_t target;
+    uint8_t type;
+};
+
+/**
+ * Build a message, also at compile time.
+ */
+constexpr messageType frameMessage(uint8_t target, uint8_t type, uint8_t source, uint8_t command, std::initializer_list<uint8_t> payload = {}) {
+    messageType message = {};
+    message.target = target;
+    message.type = type;
+    message.source = source;
+    message.command = command;
+    for(const uint8_t value : payload) {
+        message.payload[message.payloadSize++] = value;
+    }
+    return message;
+}
+
+/**
+ * Bytes of a message from the header up to the crc, unescaped: 1 for a handoff, 2 for pings, 3 + payload for commands.
+ */
+constexpr size_t frameBodyLength(const messageType& message) {
+    if(message.type == MSG_PING_REQ || message.type == MSG_PING_RESP) {
+        return 2;
+    } else if(message.type == MSG_CMD_REQ || message.type == MSG_CMD_RESP) {
+        return 3 + message.payloadSize;
+    }
+    return 1;
+}
+
+constexpr uint8_t frameBodyByte(const messageType& message, size_t index) {
+    if(index == 0) {
+        return (uint8_t)(message.target << 4 | message.type);
+    } else if(index == 1) {
+        const bool command = message.type == MSG_CMD_REQ || message.type == MSG_CMD_RESP;
+        return (uint8_t)(message.source << 4 | (command ? message.payloadSize : 0));
+    } else if(index == 2) {
+        return message.command;
+    }
+    return message.payload[index - 3];
+}
+
+/**
+ * Encode a message as it goes on the bus: start byte, header, payload, crc, with 0x10s escaped.
+ * One pass, each byte is added to the CRC and escaped straight into out, which must have room for FRAME_MAX_ENCODED_SIZE bytes.
+ * crcStep continues the CRC by a byte: crc8_bow_byte at runtime, crc8_bow_byte_bitwise at compile time.
+ * Returns the encoded length.
+ */
+template <typename CrcStep> constexpr size_t encodeFrame(const messageType& message, uint8_t *out, CrcStep crcStep) {
+    const size_t bodyLength = frameBodyLength(message);
+    uint8_t crc = crcStep(INIT, 0x10);
+    size_t pos = 0;
+    out[pos++] = 0x10;
+    for(size_t index = 0; index <= bodyLength; index++) {
+        uint8_t value = crc;
+        if(index < bodyLength) {
+            value = frameBodyByte(message, index);
+            crc = crcStep(crc, value);
+        }
+        out[pos++] = value;
+        if(value == 0x10) {
+            out[pos++] = 0x10;
+        }
+    }
+    return pos;
+}
+
+/**
+ * Encode a frame at compile time, for example: static constexpr constFrame frame = makeConstFrame(frameMessage(...));
+ * Fails to compile if it does not fit CONST_FRAME_SIZE.
+ */
+constexpr constFrame makeConstFrame(const messageType& message) {
+    uint8_t encoded[FRAME_MAX_ENCODED_SIZE] = {};
+    const size_t length = encodeFrame(message, encoded, crc8_bow_byte_bitwise);
+    constFrame frame = {};
+    for(size_t pos = 0; pos < length; pos++) {
+        frame.bytes[pos] = encoded[pos];
+    }
+    frame.length = (uint8_t)length;
+    frame.target = message.target;
+    frame.type = message.type;
+    return frame;
+}
+
+/**
+ * Encode a message, see encodeFrame(..), using the CRC implementation selected in Kconfig.
+ * Returns the encoded length, out must have room for FRAME_MAX_ENCODED_SIZE bytes.
+ */
+size_t encodeMessage(const messageType& message, uint8_t *out);
+
+/**
+ * Encode a message and send it with transportWrite(..).
+ */
+void writeMessage(const messageType& message);
+
+/**
+ * Send a prebuilt frame with transportWrite(..).
+ */
+void writeFrame(const constFrame& frame);
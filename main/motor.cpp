@@ -1,23 +1,20 @@
 #include <sys/unistd.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
-#include "freertos/timers.h"
 #include "bytes.h"
 #include "bat.h"
 #include "bow.h"
 #include "cmds.h"
+#include "data.h"
+#include "scheduler.h"
 #include "motor.h"
 
-static EventGroupHandle_t eventGroupHandle;
-static TimerHandle_t motorUpdateTimer;
+// The original BMS sends this about every 10 seconds.
+#define MOTOR_UPDATE_MIN_MS 8000
+#define MOTOR_UPDATE_MAX_MS 10000
 
-static const int MOTOR_UPDATE_BIT = BIT0;
-
-static void motorUpdateTimerCallback(TimerHandle_t xTimer) { xEventGroupSetBits(eventGroupHandle, MOTOR_UPDATE_BIT); }
+static void motorUpdateJob(void *context) { motorUpdate(); }
 
 void initMotor() {
-    eventGroupHandle = xEventGroupCreate();
-    motorUpdateTimer = xTimerCreate("motorUpdateTimer", (10000 / portTICK_PERIOD_MS), pdTRUE, (void *)0, motorUpdateTimerCallback);
+    schedulerAdd(JOB_MOTOR_UPDATE, motorUpdateJob, 2, MOTOR_UPDATE_MIN_MS, MOTOR_UPDATE_MAX_MS);
 }
 
 /**
@@ -30,31 +27,21 @@ void motorUpdate() {
     uint16_t unknown = 2500; // Normally 2500, very sometimes much lower, on low battery up hill? Amp limit in 10ma??
     uint16_t volts = getBatMv() / 100; // Volts, in 100mv
 
-    uint8_t payload[] = {
-            0x94, 0xb0,
-            FROM_UINT16(unknown), 
-            0x14, 0xb1,
-            FROM_UINT16(volts)};
-    messageType response = {};
-    readResult result = exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA, payload, sizeof(payload)), &response, 225 / portTICK_PERIOD_MS);
+    messageType request = cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA);
+    dataWriter writer;
+    dataWriterInit(&writer, request.payload, sizeof(request.payload));
+    dataWriteInt(&writer, DATA_MOTOR_LIMIT, unknown);
+    dataWriteInt(&writer, DATA_BAT_VOLTAGE, volts);
+    request.payloadSize = writer.size;
+
+    frameView response = {};
+    readResult result = exchange(request, &response);
 }
 
 void startMotorUpdates() {
-    xTimerStart(motorUpdateTimer, 0);
+    schedulerStart(JOB_MOTOR_UPDATE);
 }
 
 void stopMotorUpdates() {
-    xTimerStop(motorUpdateTimer, 0);
-}
-
-bool handleMotorUpdate() {
-    EventBits_t bitsToCheck = MOTOR_UPDATE_BIT;
-    EventBits_t bits = xEventGroupWaitBits(eventGroupHandle, bitsToCheck, false, false, 0);
-    if((bits & MOTOR_UPDATE_BIT) != 0) {
-        xEventGroupClearBits(eventGroupHandle, MOTOR_UPDATE_BIT);
-        motorUpdate();
-        return true;
-    }
-
-    return false;
+    schedulerStop(JOB_MOTOR_UPDATE);
 }
@@ -4,4 +4,3 @@ void initMotor();
 void motorUpdate();
 void startMotorUpdates();
 void stopMotorUpdates();
-bool handleMotorUpdate();
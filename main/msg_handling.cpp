@@ -1,79 +1,232 @@
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
-#include "esp_log.h"
 #include "bytes.h"
 #include "bow.h"
 #include "cmds.h"
+#include "dispatch.h"
 #include "ctrl_event_group.h"
 #include "cu3.h"
 #include "calibration.h"
 #include "trip.h"
 #include "display.h"
 #include "relays.h"
+#include "unexpected.h"
 #include "msg_handling.h"
 
-static const char *TAG = "msg_handling";
+static bool batMystery01(const frameView& message, ion_state * state) {
+    // MYSTERY BATTERY COMMAND 01
+    uint8_t payload[] = {0x02, 0x02};
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
+    return true;
+}
 
-messageHandlingResult handleMessage(const messageType& message, ion_state * state) {
+static bool batStatusMotorOff(const frameView& message, ion_state * state) {
+    state->motorOffAck = true;
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+static bool batStatusAssist(const frameView& message, ion_state * state) {
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+static bool batWakeup(const frameView& message, ion_state * state) {
+    setControlBits(WAKEUP_BIT);
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+static bool batCalibrate(const frameView& message, ion_state * state) {
+    setControlBits(CALIBRATE_BIT);
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+static bool batSetLight(const frameView& message, ion_state * state) {
+    setLight(message.payload[0]);
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+static bool batSetAssistLevel(const frameView& message, ion_state * state) {
+    state->level = message.payload[0];
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+    return true;
+}
+
+// The motor asks for this after calibrating.
+static constexpr constFrame reply2a = makeConstFrame(frameMessage(MSG_MOTOR, MSG_CMD_RESP, MSG_BMS, CMD_GET_DATA,
+                                                                  {0x00, DATA_TYPE_UINT | DATA_SIZE_1, DATA_UNKNOWN_2A, 0x01}));
+
+static bool get2a(dataWriter *writer, const dataItem& request) {
+    // GET DATA 002a 00:2a(Unknown)
+    dataWriteUint(writer, request.id, 0x01);
+    return true;
+}
+
+static void putSpeed(const dataItem& item, ion_state * state) {
+    state->speed = dataUint(item);
+    requestDisplayUpdate();
+}
+
+static void putDistance(const dataItem& item, ion_state * state) {
+    distanceUpdate(dataUint(item));
+}
+
+// The data IDs we know how to answer or take.
+static const dataProvider providers[] = {
+    {DATA_UNKNOWN_2A, get2a, NULL, &reply2a},
+    {DATA_SPEED, NULL, putSpeed},
+    {DATA_DISTANCE, NULL, putDistance},
+#if CONFIG_ION_CU3
+    {DATA_MAINTENANCE_DISTANCE, cu3GetMaintenanceDistance, NULL, &cu3MaintenanceDistanceReply},
+    {DATA_TOTAL_DISTANCE, cu3GetTotalDistance, NULL},
+    {DATA_TIME, cu3GetTime, cu3PutTime},
+    {DATA_BAT_LEVEL, cu3GetBatteryLevel, NULL},
+    {DATA_BAT_LEVEL_MAX, cu3GetBatteryLevelMax, NULL},
+    {DATA_UNKNOWN_94, cu3Get94, NULL, &cu3Reply94},
+    {DATA_MAX_SPEED, cu3GetMaxSpeed, NULL},
+    {DATA_TRIP_TIME, cu3GetTripTime, NULL},
+#endif
+};
+
+/**
+ * Find the provider for an item, by data ID only like the handlers this replaced.
+ * The type bits of the registry tags are not confirmed by captures, so the tag the sender uses is not checked.
+ */
+static const dataProvider *findProvider(const dataItem& item) {
+    for(const dataProvider& provider : providers) {
+        if(provider.id == item.id) {
+            return &provider;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Does the value size of an item match the registry. Those sizes are known: the c0/c1 PUT DATA
+ * from the motor was always 10 bytes, 2 of them speed and 4 distance.
+ */
+static bool expectedSize(const dataItem& item) {
+    const dataIdInfo *info = dataLookup(item.id);
+    return info != NULL && (item.tag & DATA_SIZE_MASK) == (info->tag & DATA_SIZE_MASK);
+}
+
+/**
+ * Answer a GET DATA for any combination of known IDs, encoding the values straight into the response.
+ */
+static bool getData(const frameView& message, ion_state * state) {
+    dataReader reader;
+    dataItem request;
+
+    // Just one item with a fixed value, the whole response is prebuilt.
+    dataReaderInit(&reader, message.payload, message.payloadSize);
+    if(dataReadRequest(&reader, &request) && reader.pos == message.payloadSize) {
+        const dataProvider *provider = findProvider(request);
+        if(provider != NULL && provider->reply != NULL && provider->reply->target == message.source) {
+            writeFrame(*provider->reply);
+            return true;
+        }
+    }
+
+    messageType response = cmdResp(message.source, MSG_BMS, message.command);
+    // Status byte, then the items.
+    response.payload[0] = 0x00;
+    dataWriter writer;
+    dataWriterInit(&writer, response.payload + 1, sizeof(response.payload) - 1);
+
+    dataReaderInit(&reader, message.payload, message.payloadSize);
+    while(dataReadRequest(&reader, &request)) {
+        const dataProvider *provider = findProvider(request);
+        if(provider == NULL || provider->get == NULL || !provider->get(&writer, request)) {
+            return false;
+        }
+    }
+    if(reader.pos != message.payloadSize || writer.failed) {
+        return false;
+    }
+
+    response.payloadSize = 1 + writer.size;
+    writeMessage(response);
+    return true;
+}
+
+/**
+ * Take a PUT DATA for any combination of known IDs, only if we know all of them.
+ */
+static bool putData(const frameView& message, ion_state * state) {
+    dataReader reader;
+    dataItem item;
+    dataReaderInit(&reader, message.payload, message.payloadSize);
+    while(dataReadValue(&reader, &item)) {
+        const dataProvider *provider = findProvider(item);
+        if(provider == NULL || provider->put == NULL || dataTagArray(item.tag) || !expectedSize(item)) {
+            return false;
+        }
+    }
+    if(reader.pos != message.payloadSize) {
+        return false;
+    }
+
+    dataReaderInit(&reader, message.payload, message.payloadSize);
+    while(dataReadValue(&reader, &item)) {
+        findProvider(item)->put(item, state);
+    }
+
+    uint8_t payload[] = {0x00};
+    writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
+    return true;
+}
+
+// All requests we answer, by type, command, data ID and payload size.
+// GET DATA and PUT DATA are keyed by their first data ID.
+static const dispatchEntry<messageHandler> entries[] = {
+    {MSG_CMD_REQ, 0x01, 0x00, 0, batMystery01},
+    {MSG_CMD_REQ, CMD_BAT_STATUS_MOTOR_OFF, 0x00, 0, batStatusMotorOff},
+    {MSG_CMD_REQ, CMD_BAT_STATUS_ASSIST, 0x00, 1, batStatusAssist},
+    {MSG_CMD_REQ, CMD_BAT_WAKEUP, 0x00, 0, batWakeup},
+    {MSG_CMD_REQ, CMD_BAT_CALIBRATE, 0x00, 1, batCalibrate},
+    {MSG_CMD_REQ, CMD_BAT_SET_LIGHT, 0x00, 1, batSetLight},
+    {MSG_CMD_REQ, CMD_BAT_SET_ASSIST_LEVEL, 0x00, 1, batSetAssistLevel},
+#if CONFIG_ION_CU3
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_MAINTENANCE_DISTANCE, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_TOTAL_DISTANCE, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_TIME, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_BAT_LEVEL, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_BAT_LEVEL_MAX, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_UNKNOWN_94, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_MAX_SPEED, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_TRIP_TIME, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_PUT_DATA, DATA_TIME, DISPATCH_ANY_SIZE, putData},
+#endif
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_CALIBRATION_1, 4, calibrationGetData},
+    {MSG_CMD_REQ, CMD_PUT_DATA, DATA_CALIBRATION_1, CAL_SIZE, calibrationPutData},
+    {MSG_CMD_REQ, CMD_GET_DATA, DATA_UNKNOWN_2A, DISPATCH_ANY_SIZE, getData},
+    {MSG_CMD_REQ, CMD_PUT_DATA, DATA_SPEED, DISPATCH_ANY_SIZE, putData},
+};
+
+static constexpr auto dispatch = makeDispatchTable(entries);
+static_assert(dispatch.unique, "Duplicate dispatch entries");
+
+messageHandlingResult handleMessage(const frameView& message, ion_state * state) {
     if(message.type == MSG_HANDOFF) {
         // Handoff back to us
         return CONTROL_TO_US;
     } else if(message.type == MSG_PING_REQ) {
         // ESP_LOGI(TAG, "|PING");
-        writeMessage(pingResp(message.source, MSG_BMS));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 0 && message.command == 0x01) {
-        // MYSTERY BATTERY COMMAND 01
-        uint8_t payload[] = {0x02, 0x02};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 0 && message.command == CMD_BAT_STATUS_MOTOR_OFF) {
-        state->motorOffAck = true;
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
+        writeFrame(pingRespFrame(message.source));
         return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 1 && message.command == CMD_BAT_STATUS_ASSIST) {
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 0 && message.command == CMD_BAT_WAKEUP) {
-        setControlBits(WAKEUP_BIT);
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 1 && message.command == CMD_BAT_CALIBRATE) {
-        setControlBits(CALIBRATE_BIT);
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 1 && message.command == CMD_BAT_SET_LIGHT) {
-        setLight(message.payload[0]);
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 1 && message.command == CMD_BAT_SET_ASSIST_LEVEL) {
-        state->level = message.payload[0];
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command));
-        return CONTROL_TO_SENDER;
-#if CONFIG_ION_CU3
-    } else if(handleCu3Message(message)) {
-        return CONTROL_TO_SENDER;
-#endif
-    } else if(handleCalibrationMessage(message)) {
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 2 && message.command == CMD_GET_DATA && message.payload[1] == 0x2a) {
-        // GET DATA 002a 00:2a(Unknown)
-        uint8_t payload[] = {0x00, message.payload[0], message.payload[1], 0x01};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        return CONTROL_TO_SENDER;
-    } else if(message.type == MSG_CMD_REQ && message.payloadSize == 10 && message.command == CMD_PUT_DATA && message.payload[1] == 0xc0 && message.payload[5] == 0xc1) {
-        // PUT DATA c0/c1
-        state->speed = toUint16(message.payload, 2);
-        distanceUpdate(toUint32(message.payload, 6));
-
-        uint8_t payload[] = {0x00};
-        writeMessage(cmdResp(message.source, MSG_BMS, message.command, payload, sizeof(payload)));
-        requestDisplayUpdate();
+    }
+
+    const int index = dispatch.find(message);
+    if(index >= 0 && dispatch.entries[index].handler(message, state)) {
         return CONTROL_TO_SENDER;
     }
 
-    ESP_LOGI(TAG, "Unexpected: Tgt:%d, Src:%d, Type:%d, Command:%d", message.target, message.source, message.type, message.command);
-    ESP_LOG_BUFFER_HEX(TAG, message.payload, message.payloadSize);
+    // Either not in the table, or rejected by the handler.
+    unexpectedRecord(message, index >= 0);
 
     return CONTROL_TO_SENDER;
-}
\ No newline at end of file
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "parser.h"
+#include "data.h"
 #include "states/states.h"
 
 enum messageHandlingResult {
@@ -9,4 +11,23 @@ enum messageHandlingResult {
     CONTROL_TO_SENDER
 };
 
-messageHandlingResult handleMessage(const messageType& message, ion_state * state);
\ No newline at end of file
+/**
+ * Handles one kind of request from the dispatch table, and replies to it.
+ * Returns false if the request turns out not to be what the entry expects after all.
+ */
+typedef bool (*messageHandler)(const frameView& message, ion_state * state);
+
+/**
+ * Answers GET DATA and PUT DATA items for one data ID.
+ */
+struct dataProvider {
+    uint8_t id;
+    // Write the value for a GET DATA request item, returns false if we can't.
+    bool (*get)(dataWriter *writer, const dataItem& request);
+    // Take the value of a PUT DATA item.
+    void (*put)(const dataItem& item, ion_state * state);
+    // The whole response when reply->target asks for just this item, for values that never change.
+    const constFrame *reply;
+};
+
+messageHandlingResult handleMessage(const frameView& message, ion_state * state);
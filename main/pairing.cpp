@@ -0,0 +1,106 @@
+#include <string.h>
+#include "esp_log.h"
+#include "bow.h"
+#include "cmds.h"
+#include "data.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "pairing.h"
+
+static const char *TAG = "pairing";
+
+static pairingCache cache;
+static bool cacheValid = false;
+
+// From the last pairingReadDisplay(..).
+static uint8_t displaySerial[8] = {};
+
+static void pairingCheckJob(void *context) {
+    // Once is enough.
+    schedulerStop(JOB_PAIRING_CHECK);
+
+    if(!pairingReadDisplay()) {
+        return;
+    }
+    if(!pairingReadMotor()) {
+        ESP_LOGW(TAG, "Cached pairing no longer valid, pairing again");
+        pairingWriteMotor();
+    }
+}
+
+void initPairing() {
+    cacheValid = dataLoad(PAIRING_NVS_KEY, &cache, sizeof(cache));
+    schedulerAdd(JOB_PAIRING_CHECK, pairingCheckJob, 5, PAIRING_CHECK_DELAY_MS, PAIRING_CHECK_DELAY_MS * 2);
+}
+
+bool pairingCached() {
+    return cacheValid;
+}
+
+static void savePairing() {
+    if(cacheValid && memcmp(cache.displaySerial, displaySerial, sizeof(displaySerial)) == 0) {
+        return;
+    }
+    memcpy(cache.displaySerial, displaySerial, sizeof(displaySerial));
+    cacheValid = true;
+    if(!dataSave(PAIRING_NVS_KEY, &cache, sizeof(cache))) {
+        ESP_LOGW(TAG, "Could not save pairing");
+    }
+}
+
+bool pairingReadDisplay() {
+    frameView response = {};
+    if(exchange(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_GET_SERIAL), &response) != MSG_OK || response.payloadSize < 8) {
+        return false;
+    }
+    memcpy(displaySerial, response.payload, 8);
+    return true;
+}
+
+bool pairingReadMotor() {
+    // Get serial progammed in motor slot 2
+    messageType request = cmdReq(MSG_MOTOR, MSG_BMS, CMD_GET_DATA);
+    dataWriter writer;
+    dataWriterInit(&writer, request.payload, sizeof(request.payload));
+    dataWriteRequest(&writer, DATA_SERIALS, 0);
+    request.payloadSize = writer.size;
+
+    uint8_t motorSlot2Serial[8] = {};
+    frameView response = {};
+    if(exchange(request, &response) == MSG_OK && response.payloadSize > 1) {
+        // Skip the status byte
+        dataReader reader;
+        dataItem item;
+        dataReaderInit(&reader, response.payload + 1, response.payloadSize - 1);
+        if(dataReadValue(&reader, &item) && item.id == DATA_SERIALS && item.count == 8) {
+            memcpy(motorSlot2Serial, item.value, 8);
+        }
+    }
+    if(memcmp(displaySerial, motorSlot2Serial, 8) != 0) {
+        return false;
+    }
+    savePairing();
+    return true;
+}
+
+void pairingWriteMotor() {
+    // Program serial in motor slot 2
+    messageType request = cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA);
+    dataWriter writer;
+    dataWriterInit(&writer, request.payload, sizeof(request.payload));
+    dataWriteArrayPut(&writer, DATA_SERIALS, 0, displaySerial, 8);
+    request.payloadSize = writer.size;
+
+    frameView response = {};
+    if(exchange(request, &response) == MSG_OK) {
+        savePairing();
+    }
+}
+
+void pairingDeferCheck() {
+    schedulerStart(JOB_PAIRING_CHECK);
+}
+
+void pairingCancelCheck() {
+    schedulerStop(JOB_PAIRING_CHECK);
+}
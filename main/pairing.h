@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Auto pairing: the motor only works with the display whose serial is in its slot 2.
+ * A confirmed pairing is cached in NVS, so waking up doesn't have to wait for the check.
+ * With a valid cache, pairingDeferCheck() does the check (and pairing if needed) a little later, from the scheduler.
+ */
+
+#define PAIRING_NVS_KEY "pairing"
+
+// Check a cached pairing this long after waking up, when assist is already on its way.
+#define PAIRING_CHECK_DELAY_MS 3000
+
+struct pairingCache {
+    // The display serial, which the motor had in slot 2.
+    uint8_t displaySerial[8];
+};
+
+/**
+ * Load the cache from flash.
+ */
+void initPairing();
+
+/**
+ * Whether we know the motor is paired with the display, from an earlier wake.
+ */
+bool pairingCached();
+
+/**
+ * Ask the display for its serial. Returns false if it did not answer.
+ */
+bool pairingReadDisplay();
+
+/**
+ * Read the serial in motor slot 2. Returns true if it is the display serial, which is then cached.
+ */
+bool pairingReadMotor();
+
+/**
+ * Program the display serial in motor slot 2, and cache it when the motor confirms.
+ */
+void pairingWriteMotor();
+
+/**
+ * Check the pairing (and pair if needed) once, after PAIRING_CHECK_DELAY_MS.
+ */
+void pairingDeferCheck();
+
+/**
+ * Don't do a deferred check, the motor is turning off.
+ */
+void pairingCancelCheck();
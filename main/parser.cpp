@@ -0,0 +1,202 @@
+#include <string.h>
+#include "crc8.h"
+#include "deferred_log.h"
+#include "parser.h"
+
+#define RING_MASK (PARSER_RING_SIZE - 1)
+
+static_assert((PARSER_RING_SIZE & RING_MASK) == 0, "PARSER_RING_SIZE must be a power of two");
+
+void parserInit(bowParser *parser) {
+    *parser = {};
+}
+
+/**
+ * Is there a slot for the next frame, or are they all held by views.
+ */
+static bool slotFree(const bowParser *parser) {
+    return parser->produced - __atomic_load_n(&parser->released, __ATOMIC_ACQUIRE) < PARSER_FRAME_SLOTS;
+}
+
+void parserRelease(bowParser *parser) {
+    // Only one task releases, so this needs no read-modify-write, only ordering after its reads of the frame.
+    __atomic_store_n(&parser->released, __atomic_load_n(&parser->released, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Forget the current frame, but keep unparsed input and older frames.
+ */
+static void startFrame(bowParser *parser) {
+    parser->escaping = false;
+    parser->started = false;
+    parser->length = 0;
+    parser->target = 0;
+    parser->source = 0;
+    parser->type = 0;
+    parser->size = 0;
+}
+
+void parserReset(bowParser *parser) {
+    parser->tail = parser->head;
+    startFrame(parser);
+}
+
+size_t parserWrite(bowParser *parser, const uint8_t *data, size_t length) {
+    size_t written = 0;
+    while(written < length) {
+        size_t space = 0;
+        uint8_t *buffer = parserWriteBuffer(parser, &space);
+        if(space == 0) {
+            break;
+        }
+        size_t chunk = length - written < space ? length - written : space;
+        memcpy(buffer, data + written, chunk);
+        parserCommit(parser, chunk);
+        written += chunk;
+    }
+    return written;
+}
+
+uint8_t *parserWriteBuffer(bowParser *parser, size_t *length) {
+    const uint16_t used = parser->head - parser->tail;
+    const uint16_t pos = parser->head & RING_MASK;
+    const uint16_t free = PARSER_RING_SIZE - used;
+    const uint16_t toEnd = PARSER_RING_SIZE - pos;
+    *length = free < toEnd ? free : toEnd;
+    return parser->ring + pos;
+}
+
+void parserCommit(bowParser *parser, size_t length) {
+    parser->head += length;
+}
+
+/**
+ * @brief Parse a single message input byte.
+ *
+ * @param value the byte
+ * @param parser the current parser state
+ */
+static readResult parseByte(uint8_t value, bowParser *parser) {
+    uint8_t low = value & 0x0f;
+    uint8_t high = value >> 4;
+
+    if(parser->length == 0) {
+        // First byte in a new message, always 0x10.
+        // We could check it, but that's already handled by the caller.
+        // We still need it, to calculate the crc.
+    } else if(parser->length == 1) {
+        // First nibble is always message target.
+        parser->target = high;
+        // Second nibble is always message type.
+        parser->type = low;
+    } else if(parser->length == 2) {
+        if(parser->type == MSG_HANDOFF) {
+            parser->size = 3;
+        } else {
+            parser->source = high;
+            if(parser->type == MSG_PING_RESP || parser->type == MSG_PING_REQ) {
+                parser->size = 4;
+            } else {
+                parser->size = low + 5;
+            }
+        }
+    }
+
+    uint8_t *data = parser->frames[parser->produced % PARSER_FRAME_SLOTS];
+    data[parser->length++] = value;
+
+    if(parser->length > 2 && parser->length == parser->size) {
+        uint8_t crc = crc8_bow(data, parser->length - 1);
+        if(crc != data[parser->length - 1]) {
+            logDeferred(DLOG_CRC_ERROR, data, parser->length);
+            return MSG_CRC_ERROR;
+        }
+        return MSG_OK;
+    }
+
+    return MSG_CONTINUE;
+}
+
+static readResult handleByte(uint8_t value, bowParser *parser) {
+    if(parser->started) {
+        // Not a message start byte, and we're not escaping, so just parse it normally.
+        return parseByte(value, parser);
+    } else if(value == 0x00) {
+        // Single 0x00 with no leading 0x10, which is sent by display to wake up system.
+        return MSG_WAKEUP;
+    } else {
+        // Unexpected bytes, continue till we find a 0x10 or 0x00
+        return MSG_CONTINUE;
+    }
+}
+
+/**
+ * Deals with message framing, (re)starts a message on a unescaped 0x10,
+ * and converts escaped 0x10s to single 0x10s
+ */
+static readResult handleFraming(uint8_t value, bowParser *parser) {
+    if(parser->escaping) {
+        parser->escaping = false;
+        if(value == 0x10) {
+            // Escaped 0x10, don't reset and just parse the value.
+            return handleByte(0x10, parser);
+        }
+
+        // Non escaped 0x10, start of message.
+        if(parser->length != 0) {
+            // We already were reading a message which we didn't get fully.
+            // Ignore it and reset state.
+            logDeferred(DLOG_INCOMPLETE, parser->frames[parser->produced % PARSER_FRAME_SLOTS], parser->length);
+            parser->incomplete++;
+            startFrame(parser);
+        }
+
+        parser->started = true;
+        // Record the start byte, no need to check result since it's always MSG_CONTINUE.
+        handleByte(0x10, parser);
+        // First content byte of the message.
+        return handleByte(value, parser);
+    } else if(value == 0x10) {
+        parser->escaping = true;
+        // Message start byte, we need to check the next input byte to decide what to do.
+        return MSG_CONTINUE;
+    } else {
+        return handleByte(value, parser);
+    }
+}
+
+readResult parserNext(bowParser *parser, frameView *frame) {
+    // The frame being parsed needs a slot of its own, each call completes at most one frame.
+    if(!slotFree(parser)) {
+        return MSG_CONTINUE;
+    }
+
+    while(parser->tail != parser->head) {
+        const uint8_t value = parser->ring[parser->tail++ & RING_MASK];
+        const readResult result = handleFraming(value, parser);
+        if(result == MSG_CONTINUE) {
+            continue;
+        }
+
+        if(result == MSG_OK) {
+            const uint8_t *data = parser->frames[parser->produced % PARSER_FRAME_SLOTS];
+            frame->target = parser->target;
+            frame->source = parser->source;
+            frame->type = parser->type;
+            frame->command = parser->size >= 5 ? data[3] : 0x00;
+            frame->payload = data + 4;
+            frame->payloadSize = parser->size >= 5 ? parser->size - 5 : 0;
+
+            // Keep this frame for the view until it's released, parse the next one into the next slot.
+            parser->produced++;
+        }
+
+        if(result != MSG_WAKEUP) {
+            // Message done, start clean for the next one.
+            startFrame(parser);
+        }
+        return result;
+    }
+
+    return MSG_CONTINUE;
+}
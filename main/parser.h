@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "message.h"
+
+enum readResult {
+    // Time-out waiting for reply on each attempt.
+    MSG_NO_REPLY,
+    // Reading timed out before getting a full message.
+    MSG_TIMEOUT,
+    // We got a '0x00' byte instead of a message.
+    MSG_WAKEUP,
+    // A message was read, but the CRC is invalid.
+    MSG_CRC_ERROR,
+    // For internal use, no error but message is not yet complete.
+    MSG_CONTINUE,
+    // Message received.
+    MSG_OK
+};
+
+// Unparsed input bytes the parser can hold, must be a power of two.
+#define PARSER_RING_SIZE (64)
+
+// Parsed frames the parser keeps, each frameView points into one of these.
+#define PARSER_FRAME_SLOTS (16)
+
+/**
+ * A received message, the header values are decoded, the payload points into the parser.
+ * The payload stays valid until the frame is handed back with parserRelease(..).
+ */
+struct frameView {
+    // The target of the message
+    uint8_t target;
+    // The source of the message, 0x00 if not used (check type)
+    uint8_t source;
+    // The type of the message
+    uint8_t type;
+    // The command byte of the message, 0x00 if not used (check type)
+    uint8_t command;
+
+    // The payload of the message, and it's length.
+    const uint8_t *payload;
+    size_t payloadSize;
+};
+
+/**
+ * Stream parser, bytes go in with parserWrite(..) (or parserWriteBuffer(..) + parserCommit(..)),
+ * frames come out with parserNext(..). Bytes not parsed yet stay in the ring, and a partially
+ * parsed frame is continued on the next call, so nothing is lost between calls.
+ */
+struct bowParser {
+    // Unparsed input. Both positions only increase, and are masked when used.
+    uint8_t ring[PARSER_RING_SIZE];
+    uint16_t head;
+    uint16_t tail;
+
+    // Are we holding the last byte to check if it's escaped.
+    bool escaping;
+
+    // We found a unescaped 0x10, indicating start of message.
+    bool started;
+
+    // Bytes of the current frame so far, including the 0x10 start byte, unescaped.
+    uint8_t length;
+
+    // Header values.
+    uint8_t target;
+    uint8_t source;
+    int8_t type;
+    int8_t size;
+
+    // The frame being parsed goes in frames[produced % PARSER_FRAME_SLOTS], older frames are kept for their views.
+    uint8_t frames[PARSER_FRAME_SLOTS][FRAME_MAX_SIZE];
+    // Frames parsed so far, and frames handed back with parserRelease(..), both only increase.
+    // Released may be written by another task than the one parsing, so it's only accessed atomically.
+    uint32_t produced;
+    uint32_t released;
+
+    // Frames dropped because the next one started before they were complete.
+    uint32_t incomplete;
+};
+
+void parserInit(bowParser *parser);
+
+/**
+ * Drop any unparsed input and partial frame, for example after a UART overflow.
+ */
+void parserReset(bowParser *parser);
+
+/**
+ * Copy bytes into the ring, returns how many fit.
+ */
+size_t parserWrite(bowParser *parser, const uint8_t *data, size_t length);
+
+/**
+ * Get the contiguous free part of the ring, to read input into directly.
+ * Follow with parserCommit(..) with the amount actually written.
+ */
+uint8_t *parserWriteBuffer(bowParser *parser, size_t *length);
+void parserCommit(bowParser *parser, size_t length);
+
+/**
+ * Parse buffered bytes until something happens.
+ * Every MSG_OK frame keeps its slot until it is released, when all slots are held
+ * parsing stops and the bytes stay buffered until a frame is released.
+ * Will return:
+ * - MSG_CONTINUE  if all buffered bytes were parsed without completing anything, or all slots are held.
+ * - MSG_WAKEUP    if a single 0x00 byte was found, which is used as a 'wakeup' signal
+ * - MSG_CRC_ERROR if a message with an invalid crc value was found
+ * - MSG_OK        if a full message was found with correct CRC, frame is set to it.
+ */
+readResult parserNext(bowParser *parser, frameView *frame);
+
+/**
+ * Hand back the oldest frame returned by parserNext(..) that was not released yet, its view is no longer used.
+ * Safe to call from another task than the one calling parserNext(..).
+ */
+void parserRelease(bowParser *parser);
@@ -0,0 +1,51 @@
+#include "deferred_log.h"
+#include "presence.h"
+
+// Nodes are addressed by a nibble.
+static presenceEntry nodes[16];
+
+void presenceSeen(uint8_t node, int64_t time) {
+    presenceEntry& entry = nodes[node & 0x0f];
+    if(entry.presence != PRESENCE_PRESENT) {
+        // Called from readEvent(..) and friends, so don't wait on the console.
+        logDeferred(DLOG_PRESENCE, NULL, 0, node, 1);
+    }
+    entry.presence = PRESENCE_PRESENT;
+    entry.lastSeen = time;
+    entry.misses = 0;
+    entry.probeIntervalMs = 0;
+}
+
+void presenceMissed(uint8_t node, int64_t time) {
+    presenceEntry& entry = nodes[node & 0x0f];
+    if(entry.misses < PRESENCE_MISSES_ABSENT) {
+        entry.misses++;
+    }
+    if(entry.presence != PRESENCE_ABSENT) {
+        if(entry.misses < PRESENCE_MISSES_ABSENT) {
+            return;
+        }
+        logDeferred(DLOG_PRESENCE, NULL, 0, node, 0);
+        entry.presence = PRESENCE_ABSENT;
+        entry.probeIntervalMs = PRESENCE_PROBE_FIRST_MS;
+    } else if(entry.probeIntervalMs < PRESENCE_PROBE_MAX_MS) {
+        entry.probeIntervalMs *= 2;
+        if(entry.probeIntervalMs > PRESENCE_PROBE_MAX_MS) {
+            entry.probeIntervalMs = PRESENCE_PROBE_MAX_MS;
+        }
+    }
+    entry.nextProbe = time + (int64_t)entry.probeIntervalMs * 1000;
+}
+
+bool presenceAvailable(uint8_t node) {
+    return nodes[node & 0x0f].presence != PRESENCE_ABSENT;
+}
+
+bool presenceProbeDue(uint8_t node, int64_t now) {
+    const presenceEntry& entry = nodes[node & 0x0f];
+    return entry.presence == PRESENCE_ABSENT && now >= entry.nextProbe;
+}
+
+const presenceEntry *presenceGet(uint8_t node) {
+    return &nodes[node & 0x0f];
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Which nodes are on the bus, so we only hand off to nodes that will answer.
+ * A node is present once we received a frame from it, and absent after it let PRESENCE_MISSES_ABSENT handoffs
+ * or probes in a row go unanswered.
+ * Absent nodes should be probed (pinged) when presenceProbeDue(..), first after PRESENCE_PROBE_FIRST_MS,
+ * then twice as long after each unanswered probe, up to PRESENCE_PROBE_MAX_MS.
+ * Only used from the task talking on the bus.
+ */
+
+// One lost handoff is not enough to skip a node, that could cost it a control window.
+#define PRESENCE_MISSES_ABSENT 2
+
+#define PRESENCE_PROBE_FIRST_MS 100
+#define PRESENCE_PROBE_MAX_MS 2000
+
+// How long to wait for a probe response, nodes that are there answer pings within a few ms.
+#define PRESENCE_PROBE_WAIT_MS 50
+
+enum nodePresence {
+    // Nothing heard from it, and nothing missed.
+    PRESENCE_UNKNOWN,
+    PRESENCE_PRESENT,
+    PRESENCE_ABSENT
+};
+
+struct presenceEntry {
+    nodePresence presence;
+    // Last frame from it, in microseconds since boot.
+    int64_t lastSeen;
+    // Handoffs and probes it did not answer since it was last seen.
+    uint8_t misses;
+    // When absent, probe it at this time.
+    int64_t nextProbe;
+    uint32_t probeIntervalMs;
+};
+
+/**
+ * A frame from this node was received.
+ */
+void presenceSeen(uint8_t node, int64_t time);
+
+/**
+ * This node did not answer a handoff or probe. Marks it absent after PRESENCE_MISSES_ABSENT in a row.
+ */
+void presenceMissed(uint8_t node, int64_t time);
+
+/**
+ * Present, or not known to be absent.
+ */
+bool presenceAvailable(uint8_t node);
+
+/**
+ * Absent, and it's time to see if it's back.
+ */
+bool presenceProbeDue(uint8_t node, int64_t now);
+
+const presenceEntry *presenceGet(uint8_t node);
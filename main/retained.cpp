@@ -0,0 +1,58 @@
+#include <stddef.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "crc8.h"
+#include "relays.h"
+#include "retained.h"
+
+#if CONFIG_ION_RESUME
+
+static const char *TAG = "retained";
+
+// Not cleared on reset, survives anything but power loss.
+static RTC_NOINIT_ATTR retainedState retained;
+// RETAINED_KEEPALIVE_MAGIC if the last software reset was the keepalive, see retainedMarkKeepalive().
+static RTC_NOINIT_ATTR uint32_t keepaliveReset;
+
+static bool resumable = false;
+
+static uint8_t retainedCrc(const retainedState& state) {
+    return crc8_bow((const uint8_t *)&state, offsetof(retainedState, crc));
+}
+
+void retainedInit() {
+    const esp_reset_reason_t reset = esp_reset_reason();
+    // Software resets only count when the keepalive did it, not for a deliberate esp_restart().
+    const bool keepalive = reset == ESP_RST_SW && keepaliveReset == RETAINED_KEEPALIVE_MAGIC;
+    keepaliveReset = 0;
+    const bool unplanned = reset == ESP_RST_PANIC || reset == ESP_RST_INT_WDT || reset == ESP_RST_TASK_WDT || reset == ESP_RST_WDT ||
+                           reset == ESP_RST_BROWNOUT || keepalive;
+    resumable = unplanned && retained.magic == RETAINED_MAGIC && retained.crc == retainedCrc(retained);
+    if(resumable) {
+        ESP_LOGI(TAG, "Resuming after reset (reason %d), motor %s, level %d, total %" PRIu32,
+                 reset, retained.motorOn ? "on" : "off", retained.level, retained.trip.total);
+    }
+}
+
+const retainedState *retainedGet() {
+    return resumable ? &retained : NULL;
+}
+
+void retainedUpdate(const ion_state * state) {
+    retained.magic = RETAINED_MAGIC;
+    getDistances(&retained.trip, &retained.motorDistance);
+    retained.level = state->level;
+    retained.light = getLight();
+    retained.motorOn = state->state == TURN_MOTOR_ON || state->state == MOTOR_ON || state->state == SET_ASSIST_LEVEL ||
+                       state->state == START_CALIBRATE;
+    retained.crc = retainedCrc(retained);
+}
+
+void retainedMarkKeepalive() {
+    keepaliveReset = RETAINED_KEEPALIVE_MAGIC;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include "trip.h"
+#include "states/states.h"
+
+/**
+ * What we need to carry on riding after a crash or keepalive reset, kept in RTC memory that survives those.
+ * Updated by the main loop, and only trusted after an unplanned reset, with the right magic and CRC.
+ */
+
+#define RETAINED_MAGIC 0x4e544552 // "RETN"
+// Set just before the keepalive restarts us, other software resets are on purpose and don't resume.
+#define RETAINED_KEEPALIVE_MAGIC 0x45564c41 // "ALVE"
+
+struct retainedState {
+    uint32_t magic;
+    tripData trip;
+    // Last distance from the motor, see distanceUpdate(..).
+    uint32_t motorDistance;
+    // Wanted assist level.
+    uint8_t level;
+    bool light;
+    // Motor was on, or turning on.
+    bool motorOn;
+    // CRC of the fields before it.
+    uint8_t crc;
+};
+
+/**
+ * Check what survived the reset, call before retainedUpdate(..).
+ */
+void retainedInit();
+
+/**
+ * The state to resume from, NULL after a planned reset or power on, or if it is not valid.
+ */
+const retainedState *retainedGet();
+
+/**
+ * Keep the current state, cheap enough to call each time around the main loop.
+ */
+void retainedUpdate(const ion_state * state);
+
+/**
+ * The keepalive is about to restart us, resume after the reset. Safe from a timer callback.
+ */
+void retainedMarkKeepalive();
@@ -0,0 +1,61 @@
+#include "sdkconfig.h"
+#include "rtt.h"
+
+#define TIMEOUT_MIN_US ((int64_t)CONFIG_ION_TIMEOUT_MIN_MS * 1000)
+// After a handoff, the node might still be talking, see ION_HANDOFF_TIMEOUT_MIN_MS.
+#define HANDOFF_TIMEOUT_MIN_US ((int64_t)CONFIG_ION_HANDOFF_TIMEOUT_MIN_MS * 1000)
+#define TIMEOUT_MAX_US ((int64_t)CONFIG_ION_TIMEOUT_MAX_MS * 1000)
+#define TIMEOUT_INITIAL_US ((int64_t)CONFIG_ION_TIMEOUT_INITIAL_MS * 1000)
+
+// Beyond this the timeout is at the ceiling anyway.
+#define MAX_BACKOFF 8
+
+// Nodes are addressed by a nibble.
+static rttEstimator estimators[16][RTT_CLASSES];
+
+static rttEstimator *estimator(uint8_t node, rttClass type) {
+    return &estimators[node & 0x0f][type];
+}
+
+void rttSample(uint8_t node, rttClass type, int64_t us) {
+    rttEstimator *rtt = estimator(node, type);
+    if(us > TIMEOUT_MAX_US) {
+        us = TIMEOUT_MAX_US;
+    }
+    if(rtt->samples == 0) {
+        rtt->srtt = us;
+        rtt->rttvar = us / 2;
+    } else {
+        // Gains of 1/8 and 1/4, as in RFC 6298.
+        const int32_t delta = us - rtt->srtt;
+        rtt->rttvar += ((delta < 0 ? -delta : delta) - rtt->rttvar) / 4;
+        rtt->srtt += delta / 8;
+    }
+    rtt->samples++;
+    rtt->backoff = 0;
+}
+
+void rttTimeout(uint8_t node, rttClass type) {
+    rttEstimator *rtt = estimator(node, type);
+    if(rtt->backoff < MAX_BACKOFF) {
+        rtt->backoff++;
+    }
+}
+
+int64_t rttTimeoutUs(uint8_t node, rttClass type) {
+    const rttEstimator *rtt = estimator(node, type);
+    int64_t timeout = rtt->samples == 0 ? TIMEOUT_INITIAL_US : rtt->srtt + 4 * (int64_t)rtt->rttvar;
+    timeout <<= rtt->backoff;
+    const int64_t minimum = type == RTT_HANDOFF ? HANDOFF_TIMEOUT_MIN_US : TIMEOUT_MIN_US;
+    if(timeout < minimum) {
+        timeout = minimum;
+    }
+    if(timeout > TIMEOUT_MAX_US) {
+        timeout = TIMEOUT_MAX_US;
+    }
+    return timeout;
+}
+
+const rttEstimator *rttGet(uint8_t node, rttClass type) {
+    return estimator(node, type);
+}
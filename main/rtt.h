@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Response time estimates per node and kind of exchange, used to pick timeouts.
+ * Works like the TCP retransmission timeout (RFC 6298): a smoothed round trip time and its mean deviation,
+ * the timeout is the smoothed time plus four deviations, clamped to CONFIG_ION_TIMEOUT_MIN_MS/MAX_MS,
+ * and doubled for each timeout in a row. Handoff gaps have their own floor, CONFIG_ION_HANDOFF_TIMEOUT_MIN_MS.
+ */
+
+enum rttClass {
+    // Command request to response.
+    RTT_COMMAND,
+    // Ping request to response.
+    RTT_PING,
+    // Gaps between messages after we hand off control.
+    RTT_HANDOFF,
+    RTT_CLASSES
+};
+
+struct rttEstimator {
+    // Smoothed round trip time and mean deviation, in microseconds.
+    int32_t srtt;
+    int32_t rttvar;
+    // Amount of samples so far.
+    uint32_t samples;
+    // Timeouts in a row, each doubles the timeout.
+    uint8_t backoff;
+};
+
+/**
+ * Add a measured time, for a response that was not to a resent request.
+ */
+void rttSample(uint8_t node, rttClass type, int64_t us);
+
+/**
+ * Note that we timed out waiting for this node.
+ */
+void rttTimeout(uint8_t node, rttClass type);
+
+/**
+ * Time to wait for this node before we resend or give up, in microseconds.
+ */
+int64_t rttTimeoutUs(uint8_t node, rttClass type);
+
+const rttEstimator *rttGet(uint8_t node, rttClass type);
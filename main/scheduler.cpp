@@ -0,0 +1,191 @@
+#include <stddef.h>
+#include "clock.h"
+#include "scheduler.h"
+
+static schedulerJob jobs[JOBS];
+
+/**
+ * A binary min-heap of job IDs, small enough to find entries by searching.
+ * Scheduled jobs wait in 'pending' by due time, then in 'ready' by deadline and priority.
+ */
+struct jobHeap {
+    uint8_t ids[JOBS];
+    uint8_t size;
+    bool (*before)(const schedulerJob& a, const schedulerJob& b);
+};
+
+static bool dueBefore(const schedulerJob& a, const schedulerJob& b) {
+    return a.due < b.due;
+}
+
+static bool deadlineBefore(const schedulerJob& a, const schedulerJob& b) {
+    return a.deadline < b.deadline || (a.deadline == b.deadline && a.priority < b.priority);
+}
+
+static jobHeap pending = { {}, 0, dueBefore };
+static jobHeap ready = { {}, 0, deadlineBefore };
+
+static bool heapBefore(const jobHeap& heap, int a, int b) {
+    return heap.before(jobs[heap.ids[a]], jobs[heap.ids[b]]);
+}
+
+static void heapSwap(jobHeap& heap, int a, int b) {
+    const uint8_t id = heap.ids[a];
+    heap.ids[a] = heap.ids[b];
+    heap.ids[b] = id;
+}
+
+static void heapUp(jobHeap& heap, int pos) {
+    while(pos > 0 && heapBefore(heap, pos, (pos - 1) / 2)) {
+        heapSwap(heap, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void heapDown(jobHeap& heap, int pos) {
+    while(true) {
+        int first = pos;
+        const int left = 2 * pos + 1;
+        const int right = left + 1;
+        if(left < heap.size && heapBefore(heap, left, first)) {
+            first = left;
+        }
+        if(right < heap.size && heapBefore(heap, right, first)) {
+            first = right;
+        }
+        if(first == pos) {
+            return;
+        }
+        heapSwap(heap, pos, first);
+        pos = first;
+    }
+}
+
+static void heapPush(jobHeap& heap, jobId id) {
+    heap.ids[heap.size] = id;
+    heap.size++;
+    heapUp(heap, heap.size - 1);
+}
+
+static jobId heapPop(jobHeap& heap) {
+    const jobId id = (jobId)heap.ids[0];
+    heap.size--;
+    heap.ids[0] = heap.ids[heap.size];
+    heapDown(heap, 0);
+    return id;
+}
+
+static void heapRemove(jobHeap& heap, jobId id) {
+    for(int pos = 0; pos < heap.size; pos++) {
+        if(heap.ids[pos] == id) {
+            heap.size--;
+            heap.ids[pos] = heap.ids[heap.size];
+            if(pos < heap.size) {
+                heapUp(heap, pos);
+                heapDown(heap, pos);
+            }
+            return;
+        }
+    }
+}
+
+static void unschedule(jobId id) {
+    heapRemove(pending, id);
+    heapRemove(ready, id);
+}
+
+static void schedule(jobId id, int64_t due, int64_t deadline) {
+    unschedule(id);
+    jobs[id].due = due;
+    jobs[id].deadline = deadline;
+    heapPush(pending, id);
+}
+
+static void moveDue(int64_t now) {
+    while(pending.size > 0 && jobs[pending.ids[0]].due <= now) {
+        heapPush(ready, heapPop(pending));
+    }
+}
+
+void schedulerAdd(jobId id, jobFunction run, uint8_t priority, uint32_t minPeriodMs, uint32_t maxPeriodMs) {
+    unschedule(id);
+    jobs[id] = {};
+    jobs[id].run = run;
+    jobs[id].priority = priority;
+    jobs[id].minPeriodMs = minPeriodMs;
+    jobs[id].maxPeriodMs = maxPeriodMs;
+}
+
+void schedulerStart(jobId id) {
+    schedulerJob& job = jobs[id];
+    if(job.run == NULL || job.active) {
+        // Already running keeps its schedule.
+        return;
+    }
+    job.active = true;
+    if(!job.requested) {
+        const int64_t now = clockNowUs();
+        schedule(id, now + (int64_t)job.minPeriodMs * 1000, now + (int64_t)job.maxPeriodMs * 1000);
+    }
+}
+
+void schedulerStop(jobId id) {
+    jobs[id].active = false;
+    jobs[id].requested = false;
+    unschedule(id);
+}
+
+void schedulerRequest(jobId id) {
+    schedulerJob& job = jobs[id];
+    if(job.run == NULL) {
+        return;
+    }
+    job.requested = true;
+    const int64_t now = clockNowUs();
+    schedule(id, now, now);
+}
+
+int schedulerRun(void *context, int64_t windowEnd) {
+    int ran = 0;
+    int64_t now = clockNowUs();
+    moveDue(now);
+    while(ready.size > 0) {
+        const jobId id = (jobId)ready.ids[0];
+        schedulerJob& job = jobs[id];
+        if(job.deadline > now && now + job.costUs > windowEnd) {
+            // Everything after it has a later deadline too, leave them for the next window.
+            break;
+        }
+        heapPop(ready);
+        job.requested = false;
+
+        const int64_t started = now;
+        job.run(context);
+        now = clockNowUs();
+        ran++;
+
+        const int32_t cost = (int32_t)(now - started);
+        job.costUs = job.costUs == 0 ? cost : job.costUs + (cost - job.costUs) / 8;
+
+        // The job may have requested or stopped itself.
+        if(job.active && !job.requested) {
+            schedule(id, started + (int64_t)job.minPeriodMs * 1000, started + (int64_t)job.maxPeriodMs * 1000);
+        }
+        moveDue(now);
+    }
+    return ran;
+}
+
+int64_t schedulerNextDue() {
+    if(ready.size > 0) {
+        return jobs[ready.ids[0]].due;
+    }
+    if(pending.size > 0) {
+        return jobs[pending.ids[0]].due;
+    }
+    return INT64_MAX;
+}
+
+const schedulerJob *schedulerGet(jobId id) {
+    return &jobs[id];
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Periodic work of the main task, mostly requests on the bus, run while we have control of the bus.
+ * A job is due minPeriodMs after it last ran, and should run before maxPeriodMs (its deadline).
+ * schedulerRun(..) runs due jobs earliest deadline first (then by priority), as long as they fit in the control window.
+ * Jobs past their deadline run anyway. How long a job takes is measured, so the window can be packed.
+ * Only used from the main task.
+ */
+
+enum jobId {
+    // CU2 button poll.
+    JOB_BUTTON_CHECK,
+    JOB_DISPLAY_UPDATE,
+    // Battery voltage to the motor.
+    JOB_MOTOR_UPDATE,
+    // Battery voltage sample (ADC), not on the bus.
+    JOB_MEASURE_BAT,
+    JOB_BUS_STATS,
+    // Once, after waking up with a cached pairing.
+    JOB_PAIRING_CHECK,
+    // While distances changed since they were saved.
+    JOB_SAVE_DISTANCES,
+    JOBS
+};
+
+// The context is what schedulerRun(..) is given.
+typedef void (*jobFunction)(void *context);
+
+struct schedulerJob {
+    jobFunction run;
+    // Lower runs first when deadlines are equal.
+    uint8_t priority;
+    uint32_t minPeriodMs;
+    uint32_t maxPeriodMs;
+    // Runs periodically, see schedulerStart(..).
+    bool active;
+    // Run once as soon as possible, see schedulerRequest(..).
+    bool requested;
+    // In microseconds since boot.
+    int64_t due;
+    int64_t deadline;
+    // Smoothed time it takes to run, in microseconds.
+    int32_t costUs;
+};
+
+/**
+ * Set up a job, it does not run until started or requested.
+ */
+void schedulerAdd(jobId id, jobFunction run, uint8_t priority, uint32_t minPeriodMs, uint32_t maxPeriodMs);
+
+/**
+ * Run the job periodically, first after minPeriodMs.
+ */
+void schedulerStart(jobId id);
+
+/**
+ * Stop running the job periodically, a pending request is dropped too.
+ */
+void schedulerStop(jobId id);
+
+/**
+ * Run the job as soon as possible, once. Also for jobs that were not started.
+ */
+void schedulerRequest(jobId id);
+
+/**
+ * Run due jobs while they fit before windowEnd (microseconds since boot), jobs past their deadline always run.
+ * Returns how many ran.
+ */
+int schedulerRun(void *context, int64_t windowEnd);
+
+/**
+ * The next time a job is due, INT64_MAX if none are scheduled.
+ */
+int64_t schedulerNextDue();
+
+const schedulerJob *schedulerGet(jobId id);
@@ -3,17 +3,16 @@
 #include "esp_log.h"
 #include "blink.h"
 #include "cmds.h"
+#include "data.h"
 #include "bow.h"
+#include "machine.h"
 #include "states.h"
 
-void toCalibrateState(ion_state * state) {
+void enterCalibrateState(ion_state * state) {
     queueBlink(10, 100, 100);
-
-    state->state = START_CALIBRATE;
-    state->step = 0;
 }
 
-void handleCalibrateState(ion_state * state) {
+void handleCalibrateState(ion_state * state, const state_inputs& inputs) {
     // TODO: Turn motor (power) on if it's off (and wait for reply? can we see that in log handoffs?)
     // - handoffs dp/bat, DP> light on, or assist level, or calibrate
     //   100 handoffs (200 msg) later: 
@@ -26,8 +25,12 @@ void handleCalibrateState(ion_state * state) {
         exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_CALIBRATE));
     } else if (state->step == 1) {
         // Get data, which is common after calibrate. No idea what it's for.
-        uint8_t payload[] = {0x00, 0xdf};
-        exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_GET_DATA, payload, sizeof(payload)));
+        messageType request = cmdReq(MSG_MOTOR, MSG_BMS, CMD_GET_DATA);
+        dataWriter writer;
+        dataWriterInit(&writer, request.payload, sizeof(request.payload));
+        dataWriteRequest(&writer, DATA_UNKNOWN_DF);
+        request.payloadSize = writer.size;
+        exchange(request);
 #if CONFIG_ION_CU3
     } else if (state->step == 2) {
         // Let the display know calibration is done, not sure about what the payload means.
@@ -35,7 +38,7 @@ void handleCalibrateState(ion_state * state) {
         exchange(cmdReq(MSG_DISPLAY, MSG_BMS, 0x2a, payload, sizeof(payload)));
 #endif
         // BMS actually stops listening here, it ignores (some?) motor messages.
-        toMotorOnState(state);
+        stateEvent(state, EV_DONE);
         return;
     }
     state->step++;
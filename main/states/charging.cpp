@@ -1,21 +1,15 @@
 #include "esp_log.h"
-#include "esp_timer.h"
 #include "bow.h"
 #include "cmds.h"
 #include "display.h"
 #include "blink.h"
 #include "relays.h"
 #include "motor.h"
+#include "clock.h"
+#include "machine.h"
 #include "states.h"
 
-static const char *TAG = "charging_state";
-
-static int64_t toChargingTime = 0;
-
-void toChargingState(ion_state * state) {
-    state->state = CHARGING;
-    state->step = 0;
-
+void enterChargingState(ion_state * state) {
     // We do want to show charge state
     state->displayOn = true;
 
@@ -30,12 +24,14 @@ void toChargingState(ion_state * state) {
     // Show charging on the display
     requestDisplayUpdate();
     startDisplayUpdates();
+}
 
-    // Remember when we changed state.
-    toChargingTime = esp_timer_get_time();
+void exitChargingState(ion_state * state) {
+    // Turning the motor on again starts with the relay off.
+    setRelay(false);
 }
 
-void handleChargingState(ion_state * state, bool chargePin) {
+void handleChargingState(ion_state * state, const state_inputs& inputs) {
 
     // First set assist level to 0, if it's set higher
     if(state->assistOn && state->levelSet > 0) {
@@ -51,18 +47,21 @@ void handleChargingState(ion_state * state, bool chargePin) {
         state->assistOn = false;
     }
 
-    if(chargePin) {
+    if(!state->doHandoffs) {
+        // Nobody reads the bus, drop what arrives so the receive queue doesn't overflow.
+        dropEvents();
+    }
+
+    if(inputs.chargePin) {
         // Wait till someone unplugs the charger.
         return;
     }
 
-    int64_t now = esp_timer_get_time();
+    int64_t now = clockNowUs();
 
     // Wait at least 3 seconds
-    if(now - toChargingTime > 3 * 1000 * 1000 ) {
-        setRelay(false);
-        // Go through the steps to fully turn motor on, seems a decent state to be in after charging, it will go back to off/idle if we don't move.
-        toTurnMotorOnState(state);
+    if(now - stateEnteredAt() > 3 * 1000 * 1000 ) {
+        stateEvent(state, EV_CHARGER_OUT);
     }
 
     return;
@@ -1,47 +1,51 @@
-#include "esp_log.h"
 #include "bow.h"
+#include "deferred_log.h"
 #include "cu2.h"
+#include "unexpected.h"
+#include "machine.h"
 #include "states.h"
 
-static const char *TAG = "idle_state";
-
 /**
  * Idle state, this is what we start at, or go to if the motor no longer responds.
  * We wait for a esp32 button click, or a wakeup message/byte '0x00' on the bus.
  * On either we switch to turn motor on state.
- * We continuously read the bus, waiting for a wakeup message/byte.
+ * We read what the bus brought each time the main loop wakes us, waiting for a wakeup message/byte.
  * The motor relay should (already) be off in this state.
 */
-void toIdleState(ion_state * state) {
-    state->state = IDLE;
-    state->step = 0;
+void enterIdleState(ion_state * state) {
+    state->doHandoffs = false;
+    // The bus is quiet now, a good time to report what we did not understand while it wasn't.
+    unexpectedLog();
 }
 
-void handleIdleState(ion_state * state, bool modeShortPress) {
-    if(modeShortPress) {
+void handleIdleState(ion_state * state, const state_inputs& inputs) {
+    if(inputs.modeShortPress) {
         // We are not polling CU2 yet, so this would be from the ESP32 button.
-        toTurnMotorOnState(state);
+        stateEvent(state, EV_WAKEUP);
         return;
     }
 
-    messageType message = {};
-    readResult result = readMessage(&message, 50 / portTICK_PERIOD_MS );
-
-    if(result == MSG_WAKEUP) {
-        // Received a '0x00' byte, sent when connecting a display, or pressing a button while the display is 'sleeping'.        
-        ESP_LOGI(TAG, "Wakeup!");
+    // Don't wait here, the main loop sleeps until there's more.
+    rxEvent event = {};
+    const frameView& message = event.message;
+    readResult result;
+    while((result = pollEvent(&event)) != MSG_TIMEOUT) {
+        if(result == MSG_WAKEUP) {
+            // Received a '0x00' byte, sent when connecting a display, or pressing a button while the display is 'sleeping'.        
+            logDeferred(DLOG_WAKEUP, NULL, 0);
 #if CONFIG_ION_CU2
-        // If the '0x00' byte is from pressing a CU2 button, we don't want to handle it again as a button press.
-        ignorePress();
+            // If the '0x00' byte is from pressing a CU2 button, we don't want to handle it again as a button press.
+            ignorePress();
 #endif
-        toTurnMotorOnState(state);
-        return;
-    }
+            stateEvent(state, EV_WAKEUP);
+            // Count from when the byte arrived, that's when the rider pressed.
+            state->wokenAt = event.time;
+            return;
+        }
 
-    if(result == MSG_OK) {
-        // TODO: Maybe wake on certain bus messages, display might be awake if the esp32 reset.
-        ESP_LOGI(TAG, "Incoming: Tgt:%d, Src:%d, Type:%d, Command:%d", message.target, message.source, message.type, message.command);
-        ESP_LOG_BUFFER_HEX(TAG, message.payload, message.payloadSize);
-        return;
+        if(result == MSG_OK) {
+            // TODO: Maybe wake on certain bus messages, display might be awake if the esp32 reset.
+            logDeferred(DLOG_INCOMING, message.payload, message.payloadSize, logFrameHeader(message.target, message.source, message.type, message.command));
+        }
     }
 }
@@ -0,0 +1,145 @@
+#include <inttypes.h>
+#include "esp_log.h"
+#include "clock.h"
+#include "machine.h"
+
+static const char *TAG = "state_machine";
+
+static const char *eventNames[CONTROL_EVENTS] = {
+    "wakeup", "done", "charger in", "charger out", "standstill", "calibrate", "level change", "quiet",
+};
+
+static const stateMachine *machine = NULL;
+static int64_t enteredAt = 0;
+
+static stateTimes timesPerState[CONTROL_STATES];
+static transitionTimes timesPerTransition[CONTROL_STATES][CONTROL_STATES];
+
+static stateTraceEntry trace[STATE_TRACE_SIZE];
+// Transitions ever recorded, the next goes at trace[traceCount % STATE_TRACE_SIZE].
+static uint32_t traceCount = 0;
+
+static const stateTransition *findTransition(control_state from, control_event event) {
+    for(size_t index = 0; index < machine->transitionCount; index++) {
+        const stateTransition& transition = machine->transitions[index];
+        if(transition.from == from && transition.event == event) {
+            return &transition;
+        }
+    }
+    return NULL;
+}
+
+void stateInit(const stateMachine *stateMachine, ion_state * state) {
+    machine = stateMachine;
+    enteredAt = clockNowUs();
+    timesPerState[state->state].entries++;
+}
+
+void stateStep(ion_state * state, const state_inputs& inputs) {
+    const stateHandler handle = machine->states[state->state].handle;
+    if(handle != NULL) {
+        handle(state, inputs);
+    }
+}
+
+bool stateEvent(ion_state * state, control_event event) {
+    const control_state from = state->state;
+    const stateTransition *transition = findTransition(from, event);
+    if(transition == NULL) {
+        return false;
+    }
+    const control_state to = transition->to;
+
+    const int64_t start = clockNowUs();
+    stateTimes& left = timesPerState[from];
+    const int64_t visitUs = start - enteredAt;
+    left.totalUs += visitUs;
+    if(visitUs > left.longestUs) {
+        left.longestUs = visitUs;
+    }
+
+    if(machine->states[from].exit != NULL) {
+        machine->states[from].exit(state);
+    }
+    state->state = to;
+    state->step = 0;
+    if(machine->states[to].enter != NULL) {
+        machine->states[to].enter(state);
+    }
+
+    enteredAt = clockNowUs();
+    timesPerState[to].entries++;
+
+    const int32_t latencyUs = (int32_t)(enteredAt - start);
+    transitionTimes& times = timesPerTransition[from][to];
+    times.count++;
+    times.totalUs += latencyUs;
+    if(latencyUs > times.longestUs) {
+        times.longestUs = latencyUs;
+    }
+
+    trace[traceCount % STATE_TRACE_SIZE] = { start, from, to, event, latencyUs };
+    traceCount++;
+    return true;
+}
+
+int64_t stateEnteredAt() {
+    return enteredAt;
+}
+
+const char *stateName(control_state state) {
+    return machine != NULL && state < CONTROL_STATES ? machine->states[state].name : "?";
+}
+
+const char *eventName(control_event event) {
+    return event < CONTROL_EVENTS ? eventNames[event] : "?";
+}
+
+size_t stateTrace(stateTraceEntry *entries, size_t size) {
+    const uint32_t kept = traceCount < STATE_TRACE_SIZE ? traceCount : STATE_TRACE_SIZE;
+    const size_t count = kept < size ? kept : size;
+    for(size_t index = 0; index < count; index++) {
+        entries[index] = trace[(traceCount - count + index) % STATE_TRACE_SIZE];
+    }
+    return count;
+}
+
+const stateTimes *stateTimesGet(control_state state) {
+    return &timesPerState[state];
+}
+
+const transitionTimes *transitionTimesGet(control_state from, control_state to) {
+    return &timesPerTransition[from][to];
+}
+
+void stateLog() {
+    if(machine == NULL) {
+        return;
+    }
+
+    for(int state = 0; state < CONTROL_STATES; state++) {
+        const stateTimes& times = timesPerState[state];
+        if(times.entries > 0) {
+            ESP_LOGI(TAG, "%s: %" PRIu32 " times, %" PRIi64 "ms in total, longest %" PRIi64 "ms",
+                     stateName((control_state)state), times.entries, times.totalUs / 1000, times.longestUs / 1000);
+        }
+    }
+
+    for(int from = 0; from < CONTROL_STATES; from++) {
+        for(int to = 0; to < CONTROL_STATES; to++) {
+            const transitionTimes& times = timesPerTransition[from][to];
+            if(times.count > 0) {
+                ESP_LOGI(TAG, "%s > %s: %" PRIu32 " times, mean %" PRIi64 "us, max %" PRIi32 "us",
+                         stateName((control_state)from), stateName((control_state)to), times.count, times.totalUs / times.count, times.longestUs);
+            }
+        }
+    }
+
+    static stateTraceEntry entries[STATE_TRACE_SIZE];
+    const size_t count = stateTrace(entries, STATE_TRACE_SIZE);
+    for(size_t index = 0; index < count; index++) {
+        const stateTraceEntry& entry = entries[index];
+        ESP_LOGI(TAG, "At %" PRIi64 "ms %s > %s on %s, %" PRIi32 "us", entry.time / 1000,
+                 stateName(entry.from), stateName(entry.to), eventName(entry.event), entry.latencyUs);
+    }
+}
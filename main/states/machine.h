@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "states.h"
+
+/**
+ * Runs the states of states.h from tables: what each state does on entry, exit and each step,
+ * and which event takes which state where. Events a state has no transition for are ignored.
+ * Going to a state resets its step, and records the transition with its time, for stateLog().
+ * Also keeps how long we spend in each state, and how long the entry/exit actions of each transition take.
+ * Time is from clockNowUs(), so it runs the same on the host. Only used from the main task.
+ */
+
+// Transitions kept for stateLog().
+#define STATE_TRACE_SIZE 16
+
+typedef void (*stateAction)(ion_state * state);
+typedef void (*stateHandler)(ion_state * state, const state_inputs& inputs);
+
+struct stateInfo {
+    const char *name;
+    // Any of these can be NULL.
+    stateAction enter;
+    stateAction exit;
+    stateHandler handle;
+};
+
+struct stateTransition {
+    control_state from;
+    control_event event;
+    control_state to;
+};
+
+struct stateMachine {
+    // Indexed by control_state.
+    const stateInfo *states;
+    const stateTransition *transitions;
+    size_t transitionCount;
+};
+
+struct stateTraceEntry {
+    // When the transition started, in microseconds since boot.
+    int64_t time;
+    control_state from;
+    control_state to;
+    control_event event;
+    // Time spent in the exit and entry actions.
+    int32_t latencyUs;
+};
+
+struct stateTimes {
+    uint32_t entries;
+    // Time in the state, for visits that ended.
+    int64_t totalUs;
+    int64_t longestUs;
+};
+
+struct transitionTimes {
+    uint32_t count;
+    int64_t totalUs;
+    int32_t longestUs;
+};
+
+/**
+ * Start the machine in the state it's in, without running entry actions.
+ */
+void stateInit(const stateMachine *machine, ion_state * state);
+
+/**
+ * Run one step of the current state.
+ */
+void stateStep(ion_state * state, const state_inputs& inputs);
+
+/**
+ * Go where the event leads from the current state: exit action, then entry action.
+ * Returns false if the event means nothing in this state.
+ */
+bool stateEvent(ion_state * state, control_event event);
+
+/**
+ * When we went to the current state, in microseconds since boot.
+ */
+int64_t stateEnteredAt();
+
+const char *stateName(control_state state);
+
+const char *eventName(control_event event);
+
+/**
+ * Copy of the last transitions, oldest first. Returns how many were copied.
+ */
+size_t stateTrace(stateTraceEntry *entries, size_t size);
+
+const stateTimes *stateTimesGet(control_state state);
+
+const transitionTimes *transitionTimesGet(control_state from, control_state to);
+
+/**
+ * Logs the time spent per state and transition, and the last transitions.
+ */
+void stateLog();
@@ -3,22 +3,26 @@
 #include "freertos/event_groups.h"
 #include "esp_log.h"
 #include "blink.h"
+#include "bow.h"
 #include "trip.h"
+#include "machine.h"
 #include "states.h"
 
-void toMotorOffState(ion_state * state) {
+void enterMotorOffState(ion_state * state) {
 
     queueBlink(4, 100, 300);
 
     saveDistances();
-
-    state->state = MOTOR_OFF;
-    state->step = 0;
 }
 
-void handleMotorOffState(ion_state * state, bool modeShortPress, bool wakeup) {
+void handleMotorOffState(ion_state * state, const state_inputs& inputs) {
     // Motor is off, but we may still get handoff messages from it, or the display (CU3).
-    if(modeShortPress || wakeup) {
-        toTurnMotorOnState(state);
+    // When we're not doing handoffs nobody else reads them, drop them so the receive queue doesn't overflow.
+    if(!state->doHandoffs) {
+        dropEvents();
+    }
+
+    if(inputs.modeShortPress || inputs.wakeup) {
+        stateEvent(state, EV_WAKEUP);
     }
 }
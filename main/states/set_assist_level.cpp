@@ -5,23 +5,21 @@
 #include "cmds.h"
 #include "bow.h"
 #include "display.h"
+#include "machine.h"
 #include "states.h"
 
 /**
  * This state changes the assist level, and turns on assist if it is required.
 */
-void toSetAssistLevelState(ion_state * state) {
+void enterSetAssistLevelState(ion_state * state) {
     if(state->level == 0) {
         queueBlink(2, 250, 50);
     } else {
         queueBlink(state->level, 100, 50);
     }
-
-    state->state = SET_ASSIST_LEVEL;
-    state->step = 0;
 }
 
-void handleSetAssistLevelState(ion_state * state) {
+void handleSetAssistLevelState(ion_state * state, const state_inputs& inputs) {
     if(state->level == 0) {
         if(state->assistOn) {
             exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_ASSIST_OFF));
@@ -34,7 +32,7 @@ void handleSetAssistLevelState(ion_state * state) {
             state->levelSet = state->level;
             requestDisplayUpdate();
         }
-        toMotorOnState(state);
+        stateEvent(state, EV_DONE);
         return;
     } else {
         if(!state->assistOn) {
@@ -51,7 +49,7 @@ void handleSetAssistLevelState(ion_state * state) {
             state->levelSet = state->level;
             requestDisplayUpdate();
 
-            toMotorOnState(state);
+            stateEvent(state, EV_DONE);
             return;
         }
     }     
@@ -0,0 +1,42 @@
+#include "machine.h"
+#include "states.h"
+
+// In control_state order.
+static const stateInfo states[CONTROL_STATES] = {
+    { "idle", enterIdleState, NULL, handleIdleState },
+    { "charging", enterChargingState, exitChargingState, handleChargingState },
+    { "calibrate", enterCalibrateState, NULL, handleCalibrateState },
+    { "turn motor on", enterTurnMotorOnState, NULL, handleTurnMotorOnState },
+    { "motor on", enterMotorOnState, NULL, handleMotorOnState },
+    { "set assist level", enterSetAssistLevelState, NULL, handleSetAssistLevelState },
+    { "turn motor off", enterTurnMotorOffState, NULL, handleTurnMotorOffState },
+    { "motor off", enterMotorOffState, NULL, handleMotorOffState },
+};
+
+/**
+ * Where each state goes on which event. Plugging in the charger works from any state but charging.
+ */
+static const stateTransition transitions[] = {
+    { IDLE, EV_WAKEUP, TURN_MOTOR_ON },
+    { TURN_MOTOR_ON, EV_DONE, MOTOR_ON },
+    { MOTOR_ON, EV_STANDSTILL, TURN_MOTOR_OFF },
+    { MOTOR_ON, EV_CALIBRATE, START_CALIBRATE },
+    { MOTOR_ON, EV_LEVEL_CHANGE, SET_ASSIST_LEVEL },
+    { START_CALIBRATE, EV_DONE, MOTOR_ON },
+    { SET_ASSIST_LEVEL, EV_DONE, MOTOR_ON },
+    { TURN_MOTOR_OFF, EV_DONE, MOTOR_OFF },
+    { MOTOR_OFF, EV_WAKEUP, TURN_MOTOR_ON },
+    { MOTOR_OFF, EV_QUIET, IDLE },
+    // Go through the steps to fully turn motor on, seems a decent state to be in after charging, it will go back to off/idle if we don't move.
+    { CHARGING, EV_CHARGER_OUT, TURN_MOTOR_ON },
+
+    { IDLE, EV_CHARGER_IN, CHARGING },
+    { START_CALIBRATE, EV_CHARGER_IN, CHARGING },
+    { TURN_MOTOR_ON, EV_CHARGER_IN, CHARGING },
+    { MOTOR_ON, EV_CHARGER_IN, CHARGING },
+    { SET_ASSIST_LEVEL, EV_CHARGER_IN, CHARGING },
+    { TURN_MOTOR_OFF, EV_CHARGER_IN, CHARGING },
+    { MOTOR_OFF, EV_CHARGER_IN, CHARGING },
+};
+
+const stateMachine controlMachine = { states, transitions, sizeof(transitions) / sizeof(transitions[0]) };
@@ -2,7 +2,26 @@
 
 #include <sys/unistd.h>
 
-enum control_state { IDLE, CHARGING, START_CALIBRATE, TURN_MOTOR_ON, MOTOR_ON, SET_ASSIST_LEVEL, TURN_MOTOR_OFF, MOTOR_OFF };
+enum control_state { IDLE, CHARGING, START_CALIBRATE, TURN_MOTOR_ON, MOTOR_ON, SET_ASSIST_LEVEL, TURN_MOTOR_OFF, MOTOR_OFF, CONTROL_STATES };
+
+// What makes us change state, which state it leads to depends on the state we're in, see states.cpp.
+enum control_event {
+    // ESP32 button or CU2 mode press, or a wakeup byte/message on the bus.
+    EV_WAKEUP,
+    // The state finished its sequence.
+    EV_DONE,
+    EV_CHARGER_IN,
+    // Charger unplugged, and we were charging for a bit.
+    EV_CHARGER_OUT,
+    // Not moving for a while, without assist.
+    EV_STANDSTILL,
+    EV_CALIBRATE,
+    // The wanted assist level is not what the motor has.
+    EV_LEVEL_CHANGE,
+    // Nobody answers handoffs anymore.
+    EV_QUIET,
+    CONTROL_EVENTS
+};
 
 struct ion_state {
     // The state we're in
@@ -31,28 +50,55 @@ struct ion_state {
 
     // Speed in km/h * 10
     uint16_t speed;
+
+    // When the wakeup byte or button press started turning the motor on, in microseconds since boot.
+    int64_t wokenAt;
+
+    // Last time we moved or had assist on, in microseconds since boot.
+    int64_t lastMoving;
 };
 
-void toIdleState(ion_state * state);
-void handleIdleState(ion_state * state, bool modeShortPress);
+// What the main loop passes to a state step, presses only reach the first step after they happened.
+struct state_inputs {
+    bool modeShortPress;
+    bool lightLongPress;
+    bool calibrate;
+    bool wakeup;
+    // Charger plugged in.
+    bool chargePin;
+};
+
+// Entry actions, run by the state machine when going to the state, see machine.h.
+// Handlers run one step of the state, and raise events with stateEvent(..).
+
+void enterIdleState(ion_state * state);
+void handleIdleState(ion_state * state, const state_inputs& inputs);
+
+void enterTurnMotorOnState(ion_state * state);
+// Go straight to turning the motor on after a reset, before stateInit(..).
+void resumeTurnMotorOnState(ion_state * state);
+void handleTurnMotorOnState(ion_state * state, const state_inputs& inputs);
 
-void toTurnMotorOnState(ion_state * state);
-void handleTurnMotorOnState(ion_state * state);
+void enterMotorOnState(ion_state * state);
+void handleMotorOnState(ion_state * state, const state_inputs& inputs);
 
-void toMotorOnState(ion_state * state);
-void handleMotorOnState(ion_state * state, bool modeShortPress, bool lightLongPress, bool calibrate);
+void enterChargingState(ion_state * state);
+void exitChargingState(ion_state * state);
+void handleChargingState(ion_state * state, const state_inputs& inputs);
 
-void toChargingState(ion_state * state);
-void handleChargingState(ion_state * state, bool chargePin);
+void enterCalibrateState(ion_state * state);
+void handleCalibrateState(ion_state * state, const state_inputs& inputs);
 
-void toCalibrateState(ion_state * state);
-void handleCalibrateState(ion_state * state);
+void enterSetAssistLevelState(ion_state * state);
+void handleSetAssistLevelState(ion_state * state, const state_inputs& inputs);
 
-void handleSetAssistLevelState(ion_state * state);
-void toSetAssistLevelState(ion_state * state);
+void enterTurnMotorOffState(ion_state * state);
+void handleTurnMotorOffState(ion_state * state, const state_inputs& inputs);
 
-void toTurnMotorOffState(ion_state * state);
-void handleTurnMotorOffState(ion_state * state);
+void enterMotorOffState(ion_state * state);
+void handleMotorOffState(ion_state * state, const state_inputs& inputs);
 
-void toMotorOffState(ion_state * state);
-void handleMotorOffState(ion_state * state, bool modeShortPress, bool wakeup);
+/**
+ * The states and transitions of the main task, for stateInit(..).
+ */
+extern const struct stateMachine controlMachine;
@@ -7,17 +7,16 @@
 #include "display.h"
 #include "relays.h"
 #include "motor.h"
+#include "pairing.h"
+#include "machine.h"
 #include "states.h"
 
-void toTurnMotorOffState(ion_state * state) {
+void enterTurnMotorOffState(ion_state * state) {
     state->displayOn = false;
     queueBlink(2, 400, 50);
-
-    state->state = TURN_MOTOR_OFF;
-    state->step = 0;
 }
 
-void handleTurnMotorOffState(ion_state * state) {
+void handleTurnMotorOffState(ion_state * state, const state_inputs& inputs) {
     if(state->assistOn) {
         exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_ASSIST_OFF));
         state->assistOn = false;
@@ -29,6 +28,7 @@ void handleTurnMotorOffState(ion_state * state) {
         if(state->step == 0) {
             stopMotorUpdates();
             stopDisplayUpdates();
+            pairingCancelCheck();
 
             state->motorOffAck = false;
             uint8_t payload[] = {0x00};
@@ -40,7 +40,7 @@ void handleTurnMotorOffState(ion_state * state) {
             if(state->motorOffAck) {
                 setRelay(false);
 
-                toMotorOffState(state);
+                stateEvent(state, EV_DONE);
             }
     }
 }
@@ -1,4 +1,4 @@
-#include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "esp_log.h"
@@ -7,23 +7,51 @@
 #include "relays.h"
 #include "bow.h"
 #include "cmds.h"
+#include "clock.h"
 #include "cu2.h"
 #include "cu3.h"
 #include "motor.h"
+#include "pairing.h"
+#include "machine.h"
 #include "states.h"
 
 static const char *TAG = "turn_motor_on_state";
 
+// Display steps before assist can be on, the motor is asked to turn on in between.
+#if CONFIG_ION_CU3
+    #define DISPLAY_INIT_STEPS 1
+#elif CONFIG_ION_CU2
+    #define DISPLAY_INIT_STEPS 5
+#else
+    #define DISPLAY_INIT_STEPS 0
+#endif
+
+// Wait this long for the motor between display steps, it answers quickly once it's up.
+// Not longer than the shortest retry timeout, so a motor that is still starting doesn't count as slow (see rtt.h).
+#define MOTOR_ON_PROBE_MS (CONFIG_ION_TIMEOUT_MIN_MS)
+
+// Whether the motor answered 'motor on' since we started turning it on.
+static bool motorOn = false;
+
+// Turning on again after a reset while riding, see resumeTurnMotorOnState(..).
+static bool resumed = false;
+
+// For reporting how long waking up takes, in microseconds since boot.
+static int64_t displayReadyAt = 0;
+static int64_t motorOnAt = 0;
+
 /**
  * Turn motor on state, motor relay was off, and now we want to turn everything on.
  * We:
- * - Turn on the display and start updating it
  * - Turn on the motor relay
- * - Send the 'motor on' command, and wait for a reply.
+ * - Turn on the display and start updating it, while the motor powers up.
+ *   In between display steps we ask the motor to turn on, without waiting long.
+ * - Send the 'motor on' command, and wait for a reply, if it did not answer yet.
  * - Start updating the motor
- * - Do the 'auto pairing': set the display serial in the motor
+ * - Do the 'auto pairing': set the display serial in the motor.
+ *   If we paired with this display before, that is checked later instead (see pairing.h).
  */
-void toTurnMotorOnState(ion_state * state) {
+void enterTurnMotorOnState(ion_state * state) {
     state->displayOn = true;
 
     // One long blink (0.5s)
@@ -32,28 +60,35 @@ void toTurnMotorOnState(ion_state * state) {
     // Turn motor relay on
     setRelay(true);
 
-    state->state = TURN_MOTOR_ON;
-    state->step = 0;
+    state->wokenAt = clockNowUs();
+
+    motorOn = false;
+    resumed = false;
+    displayReadyAt = 0;
+    motorOnAt = 0;
 }
 
-void handleTurnMotorOnState(ion_state * state) {
+void resumeTurnMotorOnState(ion_state * state) {
+    state->state = TURN_MOTOR_ON;
+    enterTurnMotorOnState(state);
 
-    static uint8_t displaySerial[8] = {};
-    static uint8_t motorSlot2Serial[8] = {};
+    // The relay went off with the reset, so the display needs its init steps again.
+    // The pairing was checked before the reset though, that is skipped.
+    resumed = true;
+}
 
+static void displayInitStep(ion_state * state) {
 #if CONFIG_ION_CU3
-    const uint8_t nextStep = 1;
     if(state->step == 0) {
         displayUpdateCu3(DSP_SCREEN, state->displayOn, true, false, 0, 0, 0, 0);
-    } else 
+    }
 #elif CONFIG_ION_CU2
-    const uint8_t nextStep = 5;
     if(state->step == 0) {
         // Button check command with a special value, maybe just resets
         // default/display? Or sets timeout? Or initializes display 'clock'?
         uint8_t payload[] = {0x80};
-        messageType message = {};
-        readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_BUTTON_POLL, payload, sizeof(payload)), &message, 225 / portTICK_PERIOD_MS );
+        frameView message = {};
+        readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_BUTTON_POLL, payload, sizeof(payload)), &message);
     } else if(state->step == 1) {
         // Update display
         displayUpdateCu2(false, ASS_OFF, BLNK_SOLID, BLNK_OFF, BLNK_SOLID, BLNK_OFF, BLNK_OFF, BLNK_SOLID, BLNK_OFF, BLNK_SOLID, BLNK_SOLID, BLNK_SOLID, true, 25, 0xccc, 0xccccc);
@@ -61,8 +96,8 @@ void handleTurnMotorOnState(ion_state * state) {
         // Unknown command which is always the same and always sent to the
         // display at this point.
         uint8_t payload[] = {0x04, 0x08};
-        messageType message = {};
-        readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, 0x25, payload, sizeof(payload)), &message, 50 / portTICK_PERIOD_MS, 5);
+        frameView message = {};
+        readResult result = exchange(cmdReq(MSG_DISPLAY, MSG_BMS, 0x25, payload, sizeof(payload)), &message, 5);
     } else if(state->step == 3) {
         // First normal button check command, after this should run every 100ms.
         buttonCheck();
@@ -70,48 +105,100 @@ void handleTurnMotorOnState(ion_state * state) {
     } else if(state->step == 4) {
         // Set default display, which is shown if the display isn't updated for a bit (?)
         displayUpdateCu2(true, ASS_OFF, BLNK_SOLID, BLNK_OFF, BLNK_SOLID, BLNK_OFF, BLNK_OFF, BLNK_SOLID, BLNK_OFF, BLNK_SOLID, BLNK_OFF, BLNK_SOLID, false, 10, 0xccc, 0xccccc);
-    } else 
-#else
-    const uint8_t nextStep = 0;
+    }
 #endif
+}
+
+/**
+ * Send 'motor on', true when the motor confirmed it.
+ * With a deadline, only send once and wait that long, otherwise keep trying as exchange(..) does.
+ */
+static bool motorOnRequest(int64_t deadlineUs) {
+    busTransaction transaction;
+    exchangeStart(&transaction, cmdReq(MSG_MOTOR, MSG_BMS, CMD_MOTOR_ON), deadlineUs > 0 ? 1 : 0, deadlineUs);
+    // A probe the motor answers too late leaves its answer on the bus, the display step after it drops that as stale.
+    // So only the motor confirming this command counts, never a late answer of the display to an earlier step.
+    if(exchangeAwait(&transaction) != MSG_OK || transaction.response.source != MSG_MOTOR || transaction.response.command != CMD_MOTOR_ON) {
+        return false;
+    }
+    motorOn = true;
+    motorOnAt = clockNowUs();
+    return true;
+}
+
+static int64_t sinceWakeMs(const ion_state * state, int64_t time) {
+    return time > 0 ? (time - state->wokenAt) / 1000 : -1;
+}
+
+/**
+ * Done, assist can be turned on from here.
+ */
+static void assistReady(ion_state * state, const char *pairing) {
+    const int64_t now = clockNowUs();
+    ESP_LOGI(TAG, "Wake to assist ready in %" PRIi64 "ms (display ready %" PRIi64 "ms, motor on %" PRIi64 "ms, pairing %s)",
+             sinceWakeMs(state, now), sinceWakeMs(state, displayReadyAt), sinceWakeMs(state, motorOnAt), pairing);
+    stateEvent(state, EV_DONE);
+}
+
+void handleTurnMotorOnState(ion_state * state, const state_inputs& inputs) {
+    if(state->step < DISPLAY_INIT_STEPS) {
+        displayInitStep(state);
+        // The motor is powering up meanwhile, see if it's there yet.
+        if(!motorOn) {
+            motorOnRequest(MOTOR_ON_PROBE_MS * 1000);
+        }
+        state->step++;
+        return;
+    }
+
     startDisplayUpdates();
-    if(state->step == nextStep) {
-        messageType message = {};
-        // Motor on
+    if(state->step == DISPLAY_INIT_STEPS) {
+        if(displayReadyAt == 0) {
+            displayReadyAt = clockNowUs();
+        }
         // Original BMS seems to repeat handoff till the motor responds, with 41ms between commands, but this should also work.
-        // The exchange(..) method keeps trying until we get a (any) valid response message adressed to us
-        exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_MOTOR_ON), &message, 41 / portTICK_PERIOD_MS);
+        // The exchange keeps trying, as fast as the motor usually responds, until we get a valid response message adressed to us,
+        // or it runs out of time.
+        if(!motorOn && !motorOnRequest(0)) {
+            // Motor is not up yet, try again next time around.
+            return;
+        }
         state->doHandoffs = true;
-    } else if(state->step == nextStep + 1) {
+    } else if(state->step == DISPLAY_INIT_STEPS + 1) {
         motorUpdate();
         startMotorUpdates();
 #if CONFIG_ION_CU2 || CONFIG_ION_CU3
-    } else if(state->step == nextStep + 2) {
-        messageType response = {};
-        exchange(cmdReq(MSG_DISPLAY, MSG_BMS, CMD_GET_SERIAL), &response);
-        memcpy(displaySerial, response.payload, 8);
-    } else if(state->step == nextStep + 3) {
-        // Get serial progammed in motor slot 2
-        messageType response = {};
-        uint8_t payload[] = {0x40, 0x5c, 0x00};
-        exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_GET_DATA, payload, sizeof(payload)), &response);
-        if(response.payload[3] == 8) {
-            memcpy(motorSlot2Serial, response.payload + 4, 8);
+    } else if(state->step == DISPLAY_INIT_STEPS + 2) {
+        if(resumed) {
+            assistReady(state, "resumed");
+            return;
         }
-        if(memcmp(displaySerial, motorSlot2Serial, 8) == 0) {
+        if(pairingCached()) {
+            // Don't make the rider wait for a check that practically always passes.
+            pairingDeferCheck();
+            assistReady(state, "cached");
+            return;
+        }
+        if(!pairingReadDisplay()) {
+            // No display to pair with.
+            ESP_LOGW(TAG, "No serial from display, skipping pairing");
+            assistReady(state, "skipped");
+            return;
+        }
+    } else if(state->step == DISPLAY_INIT_STEPS + 3) {
+        if(pairingReadMotor()) {
             // Serial already matched, no need to change it.
-            toMotorOnState(state);
+            assistReady(state, "checked");
             return;
         }
-    } else if(state->step == nextStep + 4) {
-        // Program serial in motor slot 2
-        uint8_t payload[] = {0x40, 0x5c, 0x00, 0x08, 0x08, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
-        memcpy(payload + 5, displaySerial, 8);
-        messageType response = {};
-        exchange(cmdReq(MSG_MOTOR, MSG_BMS, CMD_PUT_DATA, payload, sizeof(payload)), &response);
-#endif
-        toMotorOnState(state);
+    } else if(state->step == DISPLAY_INIT_STEPS + 4) {
+        pairingWriteMotor();
+        assistReady(state, "paired");
         return;
+#else
+        assistReady(state, "none");
+        return;
+#endif
     }
     state->step++;
 }
@@ -0,0 +1,196 @@
+#include <string.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "clock.h"
+#include "trace.h"
+
+#if CONFIG_ION_TRACE
+
+static const char *TAG = "trace";
+
+#define TRACE_SIZE (CONFIG_ION_TRACE_SIZE)
+#define TRACE_MASK (TRACE_SIZE - 1)
+
+static_assert(TRACE_SIZE >= 256 && (TRACE_SIZE & TRACE_MASK) == 0, "CONFIG_ION_TRACE_SIZE must be a power of two, and at least 256");
+
+// Data partition subtype of the trace partition, see partitions.csv.
+#define TRACE_PARTITION_SUBTYPE ((esp_partition_subtype_t)0x40)
+
+struct traceRing {
+    // TRACE_MAGIC once initialised.
+    uint32_t magic;
+    // Free running positions, the records are between tail and head.
+    uint32_t head;
+    uint32_t tail;
+    // Bus bytes not recorded.
+    uint32_t dropped;
+    // Reason to write the ring out after a software reset, 0 for none, see traceFlushAfterReset(..).
+    uint32_t pending;
+    // The oldest record's delta counts from this time.
+    int64_t tailTime;
+    // Time of the newest record.
+    int64_t headTime;
+    uint8_t data[TRACE_SIZE];
+};
+
+// Not cleared on reset, so what led up to a panic, watchdog or keepalive reset can be written out after the reboot.
+static __NOINIT_ATTR traceRing ring;
+
+// Records come from the receive task and from whoever writes to the bus.
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Set while the ring is written to flash, bytes are only counted as dropped then.
+static bool flushing = false;
+
+static void ringReset() {
+    ring.head = 0;
+    ring.tail = 0;
+    ring.dropped = 0;
+    ring.pending = 0;
+    ring.tailTime = clockNowUs();
+    ring.headTime = ring.tailTime;
+    ring.magic = TRACE_MAGIC;
+}
+
+static bool ringValid() {
+    return ring.magic == TRACE_MAGIC && ring.head - ring.tail <= TRACE_SIZE;
+}
+
+/**
+ * Drop the oldest record, its time becomes the time the next one counts from.
+ */
+static void dropOldest() {
+    uint32_t pos = ring.tail;
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = ring.data[pos++ & TRACE_MASK];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while((byte & 0x80) && shift < 64);
+    const uint8_t length = ring.data[pos++ & TRACE_MASK];
+
+    ring.tailTime += value >> 1;
+    ring.tail = pos + length;
+}
+
+static void ringPut(const uint8_t *data, size_t length) {
+    const uint32_t start = ring.head & TRACE_MASK;
+    const size_t first = length < TRACE_SIZE - start ? length : TRACE_SIZE - start;
+    memcpy(ring.data + start, data, first);
+    memcpy(ring.data, data + first, length - first);
+    ring.head += length;
+}
+
+void traceRecord(uint8_t direction, const uint8_t *data, size_t length) {
+    taskENTER_CRITICAL(&lock);
+    if(ring.magic != TRACE_MAGIC || flushing) {
+        ring.dropped += length;
+        taskEXIT_CRITICAL(&lock);
+        return;
+    }
+
+    // Taken inside the lock, so times never go backwards between records.
+    const int64_t now = clockNowUs();
+    while(length > 0) {
+        const uint8_t chunk = length > 0xff ? 0xff : length;
+
+        uint8_t header[TRACE_RECORD_HEADER_MAX];
+        const size_t headerSize = traceEncodeHeader(now - ring.headTime, direction, chunk, header);
+        while(TRACE_SIZE - (ring.head - ring.tail) < headerSize + chunk) {
+            dropOldest();
+        }
+
+        ringPut(header, headerSize);
+        ringPut(data, chunk);
+        ring.headTime = now;
+
+        data += chunk;
+        length -= chunk;
+    }
+    taskEXIT_CRITICAL(&lock);
+}
+
+static esp_err_t writeRecords(const esp_partition_t *partition, size_t offset, uint32_t size) {
+    const uint32_t start = ring.tail & TRACE_MASK;
+    const uint32_t first = size < TRACE_SIZE - start ? size : TRACE_SIZE - start;
+    esp_err_t err = esp_partition_write(partition, offset, ring.data + start, first);
+    if(err == ESP_OK && size > first) {
+        err = esp_partition_write(partition, offset + first, ring.data, size - first);
+    }
+    return err;
+}
+
+bool traceFlush(traceReason reason) {
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TRACE_PARTITION_SUBTYPE, "trace");
+    if(partition == NULL) {
+        ESP_LOGW(TAG, "No trace partition");
+        return false;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    flushing = true;
+    taskEXIT_CRITICAL(&lock);
+
+    traceHeader header = {};
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.reason = reason;
+    header.size = ring.head - ring.tail;
+    header.dropped = ring.dropped;
+    header.start = ring.tailTime;
+
+    const uint32_t total = sizeof(header) + header.size;
+    const uint32_t eraseSize = (total + partition->erase_size - 1) / partition->erase_size * partition->erase_size;
+
+    // The header goes last, so a trace that was not completely written is not taken for a valid one.
+    esp_err_t err = ESP_FAIL;
+    if(eraseSize <= partition->size) {
+        err = esp_partition_erase_range(partition, 0, eraseSize);
+        if(err == ESP_OK) {
+            err = writeRecords(partition, sizeof(header), header.size);
+        }
+        if(err == ESP_OK) {
+            err = esp_partition_write(partition, 0, &header, sizeof(header));
+        }
+    }
+
+    taskENTER_CRITICAL(&lock);
+    flushing = false;
+    taskEXIT_CRITICAL(&lock);
+
+    if(err != ESP_OK) {
+        ESP_LOGW(TAG, "Writing %" PRIu32 " bytes of trace failed (%d)", total, err);
+        return false;
+    }
+    ESP_LOGI(TAG, "Wrote %" PRIu32 " bytes of trace (reason %d, %" PRIu32 " dropped)", header.size, reason, header.dropped);
+    return true;
+}
+
+void traceFlushAfterReset(traceReason reason) {
+    taskENTER_CRITICAL(&lock);
+    ring.pending = reason;
+    taskEXIT_CRITICAL(&lock);
+}
+
+void traceInit() {
+    const esp_reset_reason_t reset = esp_reset_reason();
+    const bool crashed = reset == ESP_RST_PANIC || reset == ESP_RST_INT_WDT || reset == ESP_RST_TASK_WDT || reset == ESP_RST_WDT;
+    if(ringValid()) {
+        if(crashed) {
+            traceFlush(TRACE_PANIC);
+        } else if(reset == ESP_RST_SW && ring.pending != 0) {
+            traceFlush((traceReason)ring.pending);
+        }
+    }
+    ringReset();
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "trace_format.h"
+
+/**
+ * Start recording. Writes what was recorded before a panic, watchdog reset or traceFlushAfterReset(..)
+ * to the trace partition first.
+ */
+void traceInit();
+
+/**
+ * Record bytes that went over the bus, see trace_format.h. Safe to call from several tasks.
+ */
+void traceRecord(uint8_t direction, const uint8_t *data, size_t length);
+
+/**
+ * Write what was recorded to the trace partition, recording continues afterwards.
+ */
+bool traceFlush(traceReason reason);
+
+/**
+ * Have what was recorded written to the trace partition by traceInit() after the restart we are about to do.
+ * Doesn't touch flash, so unlike traceFlush(..) it's fine from a timer callback.
+ */
+void traceFlushAfterReset(traceReason reason);
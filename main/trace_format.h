@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Layout of a raw bus trace, as kept in RAM by trace.cpp and written to the trace partition.
+ * The partition starts with a traceHeader, followed by header.size bytes of records, oldest first.
+ * A record is a chunk of bytes that went over the bus in one direction, as one UART read or write:
+ * - varint (LEB128): microseconds since the previous record, shifted left one, or'ed with the direction
+ * - length byte
+ * - the bytes, as they were on the bus (start byte, escaping and CRC included)
+ * The first record's delta counts from header.start.
+ */
+
+#define TRACE_MAGIC 0x45435254 // "TRCE"
+#define TRACE_VERSION 1
+
+#define TRACE_RX 0
+#define TRACE_TX 1
+
+// Varint of a 64 bit value, and the length byte.
+#define TRACE_RECORD_HEADER_MAX (10 + 1)
+
+// 0 is not a reason, trace.cpp uses it for 'nothing to write'.
+enum traceReason {
+    TRACE_PANIC = 1,
+    TRACE_KEEPALIVE = 2
+};
+
+struct traceHeader {
+    uint32_t magic;
+    uint16_t version;
+    // Why it was written, a traceReason.
+    uint8_t reason;
+    uint8_t reserved;
+    // Bytes of records following the header.
+    uint32_t size;
+    // Bus bytes that were not recorded, for example while writing the trace.
+    uint32_t dropped;
+    // Time the first record's delta counts from, in microseconds since boot.
+    int64_t start;
+};
+
+/**
+ * Encode a record header, returns its length, out needs room for TRACE_RECORD_HEADER_MAX bytes.
+ */
+inline size_t traceEncodeHeader(uint64_t delta, uint8_t direction, uint8_t length, uint8_t *out) {
+    uint64_t value = (delta << 1) | (direction & 1);
+    size_t pos = 0;
+    while(value >= 0x80) {
+        out[pos++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[pos++] = (uint8_t)value;
+    out[pos++] = length;
+    return pos;
+}
+
+/**
+ * Decode a record header, returns its length, or 0 if there are not enough bytes.
+ */
+inline size_t traceDecodeHeader(const uint8_t *data, size_t available, uint64_t *delta, uint8_t *direction, uint8_t *length) {
+    uint64_t value = 0;
+    size_t pos = 0;
+    int shift = 0;
+    while(true) {
+        if(pos >= available || shift > 63) {
+            return 0;
+        }
+        const uint8_t byte = data[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+        if((byte & 0x80) == 0) {
+            break;
+        }
+    }
+    if(pos >= available) {
+        return 0;
+    }
+    *length = data[pos++];
+    *delta = value >> 1;
+    *direction = value & 1;
+    return pos;
+}
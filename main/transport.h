@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The platform side of the protocol code (message.cpp, parser.cpp, cmds.cpp, crc8.cpp, bytes.cpp).
+ * On the ESP32 bow.cpp implements this on the UART, native builds bring their own.
+ */
+
+/**
+ * Send encoded bytes on the bus.
+ */
+void transportWrite(const uint8_t *data, size_t length);
@@ -1,12 +1,50 @@
+#include "sdkconfig.h"
+#include "clock.h"
+#include "journal.h"
+#include "scheduler.h"
 #include "storage.h"
 #include "trip.h"
 
+// Save at least this often while riding, in 10m increments and microseconds.
+#define SAVE_DISTANCE (CONFIG_ION_ODOMETER_SAVE_DISTANCE_M / 10)
+#define SAVE_INTERVAL_US ((int64_t)CONFIG_ION_ODOMETER_SAVE_INTERVAL_S * 1000 * 1000)
+
 static struct tripData data;
 
+// What was last written to flash.
+static struct tripData saved;
+
+// When distances first changed since they were saved, 0 when saved.
+static int64_t changedAt = 0;
+
+// Whether distances go to the journal, or to NVS (no odometer partition).
+static bool journal = false;
+
 static uint32_t lastDistance = 0;
 
+static void changed() {
+    if(changedAt == 0) {
+        changedAt = clockNowUs();
+        schedulerStart(JOB_SAVE_DISTANCES);
+    }
+}
+
+/**
+ * Save when we rode far enough, or long enough, since the last save.
+ */
+static void saveJob(void *context) {
+    if(changedAt == 0) {
+        schedulerStop(JOB_SAVE_DISTANCES);
+        return;
+    }
+    if(data.total - saved.total >= SAVE_DISTANCE || clockNowUs() - changedAt >= SAVE_INTERVAL_US) {
+        saveDistances();
+    }
+}
+
 void resetTrip1(uint32_t distance) {
     data.trip1 = distance;
+    changed();
 }
 
 uint32_t getTrip1() {
@@ -36,12 +74,46 @@ void distanceUpdate(uint32_t distance) {
     data.total += delta;
 
     lastDistance = distance;
+
+    if(delta > 0) {
+        changed();
+    }
+}
+
+void getDistances(tripData *trip, uint32_t *motorDistance) {
+    *trip = data;
+    *motorDistance = lastDistance;
+}
+
+void restoreDistances(const tripData& trip, uint32_t motorDistance) {
+    data = trip;
+    lastDistance = motorDistance;
+    if(data.total != saved.total || data.trip1 != saved.trip1 || data.trip2 != saved.trip2) {
+        changed();
+    }
 }
 
 void loadDistances() {
-    dataLoad(TRIP_NVS_KEY_TRIPDATA, &data, sizeof(data));
+    journal = journalInit();
+    if(!journal || !journalLoad(&data)) {
+        // Saved before there was a journal, or there is no partition for it.
+        dataLoad(TRIP_NVS_KEY_TRIPDATA, &data, sizeof(data));
+    }
+    saved = data;
+
+    schedulerAdd(JOB_SAVE_DISTANCES, saveJob, 6, 1000, 2000);
 }
 
 void saveDistances() {
-    dataSave(TRIP_NVS_KEY_TRIPDATA, &data, sizeof(data));
+    if(changedAt == 0) {
+        return;
+    }
+    const bool ok = journal ? journalAppend(data) : dataSave(TRIP_NVS_KEY_TRIPDATA, &data, sizeof(data));
+    if(!ok) {
+        // Try again next time the job runs.
+        return;
+    }
+    saved = data;
+    changedAt = 0;
+    schedulerStop(JOB_SAVE_DISTANCES);
 }
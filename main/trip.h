@@ -25,8 +25,15 @@ uint32_t getTotal();
 // Distance update from the motor, distance since motor power on in 10m increments
 void distanceUpdate(uint32_t distance);
 
-// Load distances from flash
+// The distances, and the last distance from the motor, to keep over a reset (see retained.h).
+void getDistances(tripData *trip, uint32_t *motorDistance);
+
+// Continue from distances kept over a reset, they are saved like changes from the motor.
+void restoreDistances(const tripData& trip, uint32_t motorDistance);
+
+// Load distances from flash, the odometer journal if there is one (see journal.h), otherwise NVS.
+// Changes are saved from then on, at least every CONFIG_ION_ODOMETER_SAVE_DISTANCE_M or CONFIG_ION_ODOMETER_SAVE_INTERVAL_S of riding.
 void loadDistances();
 
-// Write distances to flash
+// Write distances to flash, if they changed. Only from the main task.
 void saveDistances();
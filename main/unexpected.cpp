@@ -0,0 +1,80 @@
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "clock.h"
+#include "cmds.h"
+#include "deferred_log.h"
+#include "dispatch.h"
+#include "unexpected.h"
+
+static const char *TAG = "unexpected";
+
+#define SLOT_MASK (UNEXPECTED_SLOTS - 1)
+
+static unexpectedEntry entries[UNEXPECTED_SLOTS];
+
+// Kinds in the table.
+static uint32_t kinds = 0;
+// Messages not counted because the table was full.
+static uint32_t untracked = 0;
+
+static uint32_t unexpectedKey(const frameView& message) {
+    // Same as the dispatch table, with the source in the top nibble, types only go up to 4.
+    return dispatchKey(message.type, message.command, dispatchDataId(message), message.payloadSize) | (uint32_t)(message.source & 0x0f) << 28;
+}
+
+void unexpectedRecord(const frameView& message, bool rejected) {
+    const uint32_t key = unexpectedKey(message);
+    const int64_t now = clockNowUs();
+
+    uint32_t slot = (key * 0x9e3779b1u) >> (32 - UNEXPECTED_SLOT_BITS);
+    for(int probe = 0; probe < UNEXPECTED_SLOTS; probe++, slot = (slot + 1) & SLOT_MASK) {
+        unexpectedEntry& entry = entries[slot];
+        if(entry.used && entry.key == key) {
+            entry.count++;
+            entry.lastSeen = now;
+            entry.rejected = rejected;
+            return;
+        }
+        if(!entry.used) {
+            entry.key = key;
+            entry.used = true;
+            entry.rejected = rejected;
+            entry.target = message.target;
+            entry.count = 1;
+            entry.firstSeen = now;
+            entry.lastSeen = now;
+            entry.sampleSize = message.payloadSize < sizeof(entry.sample) ? message.payloadSize : sizeof(entry.sample);
+            memcpy(entry.sample, message.payload, entry.sampleSize);
+            kinds++;
+
+            logDeferred(DLOG_UNEXPECTED, message.payload, message.payloadSize, kinds, rejected,
+                        logFrameHeader(message.target, message.source, message.type, message.command));
+            return;
+        }
+    }
+    untracked++;
+}
+
+void unexpectedLog() {
+    if(kinds == 0 && untracked == 0) {
+        return;
+    }
+    const int64_t now = clockNowUs();
+    ESP_LOGI(TAG, "%" PRIu32 " kinds of unexpected messages, %" PRIu32 " not counted", kinds, untracked);
+    for(const unexpectedEntry& entry : entries) {
+        if(!entry.used) {
+            continue;
+        }
+        const uint8_t source = entry.key >> 28;
+        const uint8_t type = (entry.key >> 24) & 0x0f;
+        const uint8_t command = (entry.key >> 16) & 0xff;
+        const uint8_t dataId = (entry.key >> 8) & 0xff;
+        const uint8_t size = entry.key & 0xff;
+        const char *name = cmdName(command);
+        ESP_LOGI(TAG, "Tgt:%d, Src:%d, Type:%d, Command:%02x %s, Data:%02x, Size:%d%s: %" PRIu32 " times, first %" PRIi64 "s ago, last %" PRIi64 "s ago",
+                 entry.target, source, type, command, name != NULL ? name : "", dataId, size, entry.rejected ? " (rejected)" : "", entry.count,
+                 (now - entry.firstSeen) / 1000000, (now - entry.lastSeen) / 1000000);
+        ESP_LOG_BUFFER_HEX(TAG, entry.sample, entry.sampleSize);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "parser.h"
+
+/**
+ * Inventory of messages handleMessage(..) did not answer, instead of logging each one.
+ * Messages are grouped by source, type, command, payload size and data ID (for GET/PUT DATA),
+ * in a fixed size hash table. Only updated and read by the task handling messages.
+ */
+
+// Must be a power of two.
+#define UNEXPECTED_SLOT_BITS 5
+#define UNEXPECTED_SLOTS (1 << UNEXPECTED_SLOT_BITS)
+
+struct unexpectedEntry {
+    uint32_t key;
+    bool used;
+    // Known request, but the handler rejected it.
+    bool rejected;
+    uint8_t target;
+    uint32_t count;
+    // Microseconds since boot.
+    int64_t firstSeen;
+    int64_t lastSeen;
+    // The payload of the first one.
+    uint8_t sample[15];
+    uint8_t sampleSize;
+};
+
+/**
+ * Count an unexpected message. The first of a kind is also logged, deferred.
+ */
+void unexpectedRecord(const frameView& message, bool rejected);
+
+/**
+ * Log all kinds seen so far, with counts and a sample payload. Logs nothing if there were none.
+ * Called when the bus went quiet (entering the idle state), and with the bus statistics if those are enabled.
+ */
+void unexpectedLog();